@@ -1,6 +1,7 @@
-/* Compile this file with a C++11 compiler. */
+/* Compile this file with a C++11 compiler, with -pthread where threads need it. */
 
 #include <stdio.h>
+#include <stdarg.h>
 #include <math.h>
 #include <fstream>
 #include <vector>
@@ -9,6 +10,49 @@
 #include <typeinfo>
 #include <map>
 #include <math.h>
+#include <string.h>
+#include <sstream>
+#include <algorithm>
+#include <limits>
+#include <chrono>
+#include <initializer_list>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#else
+#include <direct.h>
+#include <process.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define POGOPROTO_URING
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#ifdef POGOPROTO_ZLIB
+#include <zlib.h>
+#include <future>
+#include <functional>
+#endif
+
+#include "pogoproto.h"
 
 /* Protobuff wire types */
 enum class WireType
@@ -65,10 +109,17 @@ public:
     operator FILE*() {return f;}
 };
 
+/* Opens a report file for writing. An existing file is removed instead of truncated, as it may be a hard link into the -cache directory. */
+FILE *createReport(const char *name)
+{
+    remove(name);
+    return fopen(name, "w");
+}
+
 /* Generic buffer struct.  */
 struct Buffer
 {
-    uint8_t *buf;
+    const uint8_t *buf;
     size_t n;
 };
 
@@ -85,6 +136,30 @@ struct Message
     } data;
 
     Message() {type = WireType::UNKNOWN_TYPE;}
+
+    /* The value of a BIT32 message as a float. */
+    float getFloat() const
+    {
+        float value;
+
+        memcpy(&value, data.fixed, 4);
+
+        return value;
+    }
+
+    /* The value of a BIT64 message as a double. */
+    double getDouble() const
+    {
+        double value;
+
+        memcpy(&value, data.fixed, 8);
+
+        return value;
+    }
+
+    /* Start and end of the bytes of a length prefixed message, eg. a string. */
+    const char *begin() const {return (const char *)data.subMessage.buf;}
+    const char *end() const {return (const char *)data.subMessage.buf + data.subMessage.n;}
 };
 
 class BufferOverflowException : public std::exception
@@ -114,504 +189,6827 @@ public:
     virtual const char *what() const throw() {return "Unsupported wire type"; }
 };
 
-/* Represents a data buffer to be parsed as protobuff. */
+/* Number of set bits. */
+inline int popcount64(uint64_t x)
+{
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+
+    return (x * 0x0101010101010101ULL) >> 56;
+}
+
+/* Number of bytes with the high bit clear, ie. the number of varints ending in the range. */
+inline size_t countVarIntTerminators(const uint8_t *p, size_t n)
+{
+    size_t count = 0;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(p + i));
+
+        count += 16 - popcount64(_mm_movemask_epi8(bytes));
+    }
+#endif
+    for (; i < n; i++)
+    {
+        count += !(p[i] & 0x80);
+    }
+
+    return count;
+}
+
+/* Set of field tags to read, see ProtoBuf::getMessage(Message &, const TagSet &).
+    Tags above 255 are never in the set.
+ */
+class TagSet
+{
+    uint64_t bits[4];
+
+public:
+    TagSet(std::initializer_list<int> tags)
+    {
+        memset(bits, 0, sizeof(bits));
+        for (int tag : tags)
+        {
+            if ((tag >= 0) && (tag < 256)) bits[tag / 64] |= 1ULL << (tag % 64);
+        }
+    }
+
+    bool contains(uint64_t tag) const {return (tag < 256) && ((bits[tag / 64] >> (tag % 64)) & 1);}
+};
+
+/* Result of the non throwing decode functions. */
+enum class DecodeStatus
+{
+    OK,
+    BUFFER_OVERFLOW, // The data ends in the middle of a value.
+    INVALID_MESSAGE, // Length past the end of the message, END_GROUP out of a group...
+    UNSUPPORTED_TYPE // Wire type 6 or 7.
+};
+
+/* Why and where decoding failed. */
+struct DecodeError
+{
+    DecodeStatus status;
+    const uint8_t *at; // The byte the error was found at.
+
+    DecodeError() : status(DecodeStatus::OK), at(NULL) {}
+
+    DecodeStatus set(DecodeStatus status, const uint8_t *at)
+    {
+        this->status = status;
+        this->at = at;
+
+        return status;
+    }
+};
+
+/* Throws the exception of the throwing API for the status. */
+inline void throwOnError(DecodeStatus status)
+{
+    switch (status)
+    {
+        case DecodeStatus::OK: return;
+        case DecodeStatus::BUFFER_OVERFLOW: throw BufferOverflowException();
+        case DecodeStatus::INVALID_MESSAGE: throw InvalidMessageException();
+        case DecodeStatus::UNSUPPORTED_TYPE: throw UnsupportedTypeException();
+    }
+}
+
+/* Represents a data buffer to be parsed as protobuff.
+    The try* functions return a status instead of throwing and never throw, getErrorPtr() tells where the error was found.
+    The others are wrappers throwing the exception of the status.
+ */
 class ProtoBuf
 {
     Buffer buf;
     size_t ptr;
+    size_t errorPos;
 
-    /* Reads single byte from the buffer. */
-    uint8_t getByte()
+    DecodeStatus fail(DecodeStatus status, size_t pos) noexcept
     {
-        if (ptr >= buf.n) throw BufferOverflowException();
+        errorPos = pos;
 
-        return buf.buf[ptr++];
+        return status;
     }
 
 public:
 
     /* Reads more bytes */
-    void readBytes(uint8_t *bytes, size_t n)
+    DecodeStatus tryReadBytes(uint8_t *bytes, size_t n) noexcept
     {
-        for (size_t i = 0; i < n; i++)
-        {
-            bytes[i] = getByte();
-        }
+        if (n > getBytesLeft()) return fail(DecodeStatus::BUFFER_OVERFLOW, buf.n);
+
+        memcpy(bytes, buf.buf + ptr, n);
+        ptr += n;
+
+        return DecodeStatus::OK;
     }
 
+    void readBytes(uint8_t *bytes, size_t n) {throwOnError(tryReadBytes(bytes, n));}
+
     /* Reads varint.
         When the high bit is set, it indicates there are more bytes to be read.
         The low 7 bits encode the the payload in little endian order.
      */
-    uint64_t readVarInt()
+    DecodeStatus tryReadVarInt(uint64_t &result) noexcept
     {
-        uint64_t result = 0;
+        result = 0;
 
         for (int i = 0; i < 10; i++)
         {
-            uint8_t byte = getByte();
+            if (ptr >= buf.n) return fail(DecodeStatus::BUFFER_OVERFLOW, ptr);
+
+            uint8_t byte = buf.buf[ptr++];
 
             result |= (uint64_t)(byte & 0x7F) << (7*i);
 
             if (!(byte & 0x80)) break;
         }
 
+        return DecodeStatus::OK;
+    }
+
+    uint64_t readVarInt()
+    {
+        uint64_t result;
+
+        throwOnError(tryReadVarInt(result));
+
         return result;
     }
 
+    /* Reads the rest of the buffer as packed repeated varints and appends them to the container.
+        The container grows once, by the number of terminator bytes in the buffer.
+     */
+    template <typename Container>
+    DecodeStatus tryReadPackedVarInts(Container &values)
+    {
+        typedef typename Container::value_type T;
+
+        values.reserve(values.size() + countVarIntTerminators(buf.buf + ptr, getBytesLeft()));
+
+        // While a varint of any length fits, decode without checking each byte for the end of buffer.
+        while (getBytesLeft() >= 10)
+        {
+            const uint8_t *p = buf.buf + ptr;
+            uint64_t word;
+
+            memcpy(&word, p, 8);
+            if (!(word & 0x8080808080808080ULL))
+            {
+                // Eight single byte varints.
+                for (int i = 0; i < 8; i++) values.push_back((T)p[i]);
+                ptr += 8;
+                continue;
+            }
+
+            uint64_t result = 0;
+            int i = 0;
+
+            while (i < 10)
+            {
+                uint8_t byte = p[i++];
+
+                result |= (uint64_t)(byte & 0x7F) << (7 * (i - 1));
+                if (!(byte & 0x80)) break;
+            }
+            ptr += i;
+            values.push_back((T)result);
+        }
+
+        while (getBytesLeft())
+        {
+            uint64_t value;
+            DecodeStatus status = tryReadVarInt(value);
+
+            if (status != DecodeStatus::OK) return status;
+            values.push_back((T)value);
+        }
+
+        return DecodeStatus::OK;
+    }
+
+    template <typename Container>
+    void readPackedVarInts(Container &values) {throwOnError(tryReadPackedVarInts(values));}
+
+    /* Reads the rest of the buffer as packed repeated fixed size values (fixed32, sfixed32, float, fixed64...) and appends them to the container.
+        The length is validated once and the values are copied as a block, the host must be little endian.
+     */
+    template <typename Container>
+    DecodeStatus tryReadPackedFixed(Container &values)
+    {
+        typedef typename Container::value_type T;
+        static_assert((sizeof(T) == 4) || (sizeof(T) == 8), "Packed fixed values are 32 or 64 bits.");
+
+        size_t n = getBytesLeft() / sizeof(T);
+        size_t old = values.size();
+
+        if (getBytesLeft() % sizeof(T)) return fail(DecodeStatus::INVALID_MESSAGE, ptr);
+        if (!n) return DecodeStatus::OK;
+
+        values.resize(old + n);
+        memcpy(&values[old], buf.buf + ptr, n * sizeof(T));
+        ptr += n * sizeof(T);
+
+        return DecodeStatus::OK;
+    }
+
+    template <typename Container>
+    void readPackedFixed(Container &values) {throwOnError(tryReadPackedFixed(values));}
+
     /* Construct from pointer and length. */
-    ProtoBuf(uint8_t *buf, size_t n)
+    ProtoBuf(const uint8_t *buf, size_t n)
     {
         this->buf.buf = buf;
         this->buf.n = n;
         ptr = 0;
+        errorPos = 0;
     }
 
     /* Construct from protobuff message. */
     ProtoBuf(const Message &msg)
     {
-        if (msg.type != WireType::LENGTH_PREFIXED) throw InvalidArgumentException("Not a length prefixed message.");
+        if ((msg.type != WireType::LENGTH_PREFIXED) && (msg.type != WireType::START_GROUP)) throw InvalidArgumentException("Not a length prefixed message or group.");
 
         this->buf.buf = msg.data.subMessage.buf;
         this->buf.n = msg.data.subMessage.n;
         ptr = 0;
+        errorPos = 0;
     }
 
     /* Number of bytes left  to read. */
-    size_t getBytesLeft() {return buf.n - ptr; }
+    size_t getBytesLeft() const {return buf.n - ptr; }
 
     /* Position in buffer.  */
-    size_t getBufPos() {return ptr;}
+    size_t getBufPos() const {return ptr;}
 
-    /* Reads a message from the buffer. */
-    Message getMessage()
+    /* Where the last failed try* call found the error. */
+    const uint8_t *getErrorPtr() const {return buf.buf + errorPos;}
+
+    /* Reads a message from the buffer.
+        Groups are returned as a START_GROUP message with the fields of the group as the submessage.
+     */
+    DecodeStatus tryGetMessage(Message &msg) noexcept
     {
-        uint64_t messageTag = readVarInt();
-        Message msg;
+        uint64_t messageTag;
+        DecodeStatus status = tryReadVarInt(messageTag);
+
+        if (status != DecodeStatus::OK) return status;
 
         msg.type = (WireType)(messageTag & 7);
         msg.tag = messageTag >> 3;
 
-        switch (msg.type)
-        {
-            case WireType::VARINT: msg.data.varInt = readVarInt(); break;
-            case WireType::BIT32:
-                msg.data.fixed[0] = getByte();
-                msg.data.fixed[1] = getByte();
-                msg.data.fixed[2] = getByte();
-                msg.data.fixed[3] = getByte();
-                break;
-            case WireType::BIT64:
-                msg.data.fixed[0] = getByte();
-                msg.data.fixed[1] = getByte();
-                msg.data.fixed[2] = getByte();
-                msg.data.fixed[3] = getByte();
-                msg.data.fixed[4] = getByte();
-                msg.data.fixed[5] = getByte();
-                msg.data.fixed[6] = getByte();
-                msg.data.fixed[7] = getByte();
-                break;
-            case WireType::LENGTH_PREFIXED:
-                {
-                    uint64_t length = readVarInt();
+        return tryReadValue(msg);
+    }
 
-                    if (length > getBytesLeft())
-                    {
-                        throw InvalidMessageException();
-                    }
-                    msg.data.subMessage.buf = buf.buf + ptr;
-                    msg.data.subMessage.n = length;
-                    ptr += length;
-                }
-                break;
-            default:
-                throw UnsupportedTypeException();
-        }
+    Message getMessage()
+    {
+        Message msg;
+
+        throwOnError(tryGetMessage(msg));
 
         return msg;
     }
 
-    /* Gets the address the current byte (for debugging). */
-    uint8_t *getptr() {return buf.buf + ptr;}
+    /* Reads the next message with a tag in the set, the others are skipped without reading their values.
+        found is false at the end of the buffer.
+     */
+    DecodeStatus tryGetMessage(Message &msg, const TagSet &wanted, bool &found) noexcept
+    {
+        found = false;
 
+        while (getBytesLeft())
+        {
+            uint64_t messageTag;
+            DecodeStatus status = tryReadVarInt(messageTag);
 
-};
+            if (status != DecodeStatus::OK) return status;
 
-/* To dump message for debugging. */
-void dumpMessage(const Message &msg)
-{
-    printf("Message tag: %d\n", msg.tag);
-    printf("Message type: %d\n", (int)msg.type);
+            WireType type = (WireType)(messageTag & 7);
 
-    switch (msg.type)
-    {
-        case WireType::LENGTH_PREFIXED:
-            printf("%zd bytes long submessage.\n", msg.data.subMessage.n);
-            break;
-        case WireType::VARINT:
-            printf("Varint: %llu\n", (unsigned long long)msg.data.varInt);
-            break;
-        case WireType::BIT32:
-            printf("32 bit data: ");
-            for (int i = 0; i < 4; i++) printf("%02x ", msg.data.fixed[i]);
-            printf("\n");
-            break;
-        case WireType::BIT64:
-            printf("32 bit data: ");
-            for (int i = 0; i < 8; i++) printf("%02x ", msg.data.fixed[i]);
-            printf("\n");
-            break;
-        default:;
+            if (wanted.contains(messageTag >> 3))
+            {
+                msg.type = type;
+                msg.tag = messageTag >> 3;
+                found = true;
+
+                return tryReadValue(msg);
+            }
+
+            status = trySkipField(type);
+            if (status != DecodeStatus::OK) return status;
+        }
+
+        return DecodeStatus::OK;
     }
-}
 
-/* Represents the info about the pokémon. */
-struct PokemonInfo
-{
-    int id;
-    std::string name;
-    int baseAtk;
-    int baseDef;
-    int baseStamina;
-    std::vector<int> fastMoves; // Ids of fast moves
-    std::vector<int> chargedMoves; // Ids of charged moves
-    size_t nAvailableFastMoves;
-    size_t nAvailableChargedMoves;
+    /* Returns false at the end of the buffer. */
+    bool getMessage(Message &msg, const TagSet &wanted)
+    {
+        bool found;
 
-    std::vector<int> pokemonTypes; // Ids of the two pokémon types.
-    //------ Computed info
-    double maxCP;
-    double tankiness; // base attack times base defense (perfect IV assumed)
-    double trueStrength; // product of all the 3 base stats.  (perfect IV assumed)
-    double prestigerCPMultiplier;
-};
+        throwOnError(tryGetMessage(msg, wanted, found));
 
-/* Info about the moves. */
-struct MoveInfo
-{
-    int id;
-    std::string name;
-    float power;
-    double duration; // In seconds
-    int energy;
-    int moveType;
-    // --------
-    double eps; // Energy per second
-    double dps; // Damage per second
-    double dpe; // Damage per energy
-};
+        return found;
+    }
 
-std::string removeFast(const std::string &name)
-{
-    std::string result = name;
+    /* Skips the value of a field whose key has been read.
+        Groups are skipped with everything nested in them up to the matching END_GROUP.
+     */
+    DecodeStatus trySkipField(WireType type) noexcept
+    {
+        uint64_t value;
+        size_t end;
 
-    for (int i = 0; i < 5; i++) result.pop_back();
+        switch (type)
+        {
+            case WireType::VARINT: return tryReadVarInt(value);
+            case WireType::BIT32: return trySkipBytes(4);
+            case WireType::BIT64: return trySkipBytes(8);
+            case WireType::LENGTH_PREFIXED:
+                {
+                    DecodeStatus status = tryReadVarInt(value);
 
-    return result;
-}
+                    return status == DecodeStatus::OK ? trySkipBytes(value) : status;
+                }
+            case WireType::START_GROUP: return trySkipGroup(end);
+            case WireType::END_GROUP: return fail(DecodeStatus::INVALID_MESSAGE, ptr); // Not in a group.
+            default:
+                return fail(DecodeStatus::UNSUPPORTED_TYPE, ptr);
+        }
+    }
 
-std::string normalizeName(const std::string &name)
-{
-    std::string result;
+    void skipField(WireType type) {throwOnError(trySkipField(type));}
 
-    for (size_t i = 0; i < name.size(); i++)
+private:
+    DecodeStatus trySkipBytes(uint64_t n) noexcept
     {
-        if (i == 0) result.push_back(name[i]);
-        else if (name[i] == '_') result.push_back(' ');
-        else result.push_back(name[i] + 32);
+        if (n > getBytesLeft()) return fail(DecodeStatus::INVALID_MESSAGE, ptr);
+
+        ptr += n;
+
+        return DecodeStatus::OK;
     }
 
-    return result;
-}
+    /* Skips to past the END_GROUP closing the group just started, nested groups included.
+        end is the position of the END_GROUP key.
+     */
+    DecodeStatus trySkipGroup(size_t &end) noexcept
+    {
+        for (int depth = 1; depth; )
+        {
+            uint64_t messageTag;
 
-std::map<int, PokemonInfo> pokemonList; // List of pokémon
-std::map<int, MoveInfo> moveList; // List of moves
-std::map<int, std::string> typeNames; // Names of types
-std::map<int, std::map<int, float>> typeChart; // Type chart
+            end = ptr;
 
-std::map<std::string, bool> filtered; // Pokémon to ignore in the calculations.
+            DecodeStatus status = tryReadVarInt(messageTag);
+            if (status != DecodeStatus::OK) return status;
 
-std::map<std::string, int> pokemonNameToId; // Map pokémon names to Ids.
-std::map<std::string, int> moveNameToId; // Map moves to Ids.
+            WireType type = (WireType)(messageTag & 7);
 
-/* Pokémon + moveset tuple and their properties. */
-struct MovesetDPS
-{
-    int pokemonId;
-    int fastId;
-    int chargedId;
-    bool isLegacy;
-    bool dodging;
-    double DPS; // Moveset DPS * attack
-    double msDPS; // Moveset DPS
-    double truePower; // Moveset DPS * trueStrength
-    double prestigePower; // Moveset DPS * prestigePotential
-    int fastAttacksPerTurn;
-    int nChargedUsed;
+            if (type == WireType::START_GROUP) depth++;
+            else if (type == WireType::END_GROUP) depth--;
+            else
+            {
+                status = trySkipField(type);
+                if (status != DecodeStatus::OK) return status;
+            }
+        }
 
-    void populate(double rawDPS, double prestigerDPS, const PokemonInfo &pi)
-    {
-        msDPS = rawDPS;
-        DPS = rawDPS * (pi.baseAtk + 15);
-        truePower = rawDPS * pi.trueStrength * (dodging ? 1 : 0.25);
-        prestigePower = prestigerDPS * pi.trueStrength * pow(pi.prestigerCPMultiplier, 3);
+        return DecodeStatus::OK;
     }
 
-    void printEntry(FILE *f, double value) const
+    /* Reads the value of the message whose key has been read. */
+    DecodeStatus tryReadValue(Message &msg) noexcept
     {
-        fprintf(f, "- %s: %s + %s : %g  (msDPS: %g) %s %s (Fast attacks per turn: %d, Number of chargeds used: %d)\n",
-            normalizeName(pokemonList[pokemonId].name).c_str(),
-            normalizeName(removeFast(moveList[fastId].name)).c_str(),
-            normalizeName(moveList[chargedId].name).c_str(),
-            value,
-            msDPS,
-            isLegacy ? "(*)" : "",
-            dodging ? "" : "(cannot dodge)",
-            fastAttacksPerTurn,
-            nChargedUsed
-        );
-    }
-};
+        switch (msg.type)
+        {
+            case WireType::VARINT: return tryReadVarInt(msg.data.varInt);
+            case WireType::BIT32: return tryReadBytes(msg.data.fixed, 4);
+            case WireType::BIT64: return tryReadBytes(msg.data.fixed, 8);
+            case WireType::LENGTH_PREFIXED:
+                {
+                    size_t start = ptr;
+                    uint64_t length;
+                    DecodeStatus status = tryReadVarInt(length);
 
-enum class PogoProtoTag
-{
-    ITEM_TEMPLATE = 2,
-};
+                    if (status != DecodeStatus::OK) return status;
+                    if (length > getBytesLeft()) return fail(DecodeStatus::INVALID_MESSAGE, start);
 
-enum class ItemTemplateTag
+                    msg.data.subMessage.buf = buf.buf + ptr;
+                    msg.data.subMessage.n = length;
+                    ptr += length;
+                }
+                return DecodeStatus::OK;
+            case WireType::START_GROUP:
+                {
+                    size_t start = ptr;
+                    size_t end;
+                    DecodeStatus status = trySkipGroup(end);
+
+                    if (status != DecodeStatus::OK) return status;
+
+                    msg.data.subMessage.buf = buf.buf + start;
+                    msg.data.subMessage.n = end - start;
+                }
+                return DecodeStatus::OK;
+            case WireType::END_GROUP:
+                return fail(DecodeStatus::INVALID_MESSAGE, ptr); // Not in a group.
+            default:
+                return fail(DecodeStatus::UNSUPPORTED_TYPE, ptr);
+        }
+    }
+
+public:
+
+    /* Gets the address the current byte (for debugging). */
+    const uint8_t *getptr() {return buf.buf + ptr;}
+};
+
+/* The fields of a buffer for range-for loops. The messages are views into the buffer, nothing is copied or allocated.
+
+    for (const Message &field : FieldRange(msg, tags))
+    {
+        for (const Message &nested : FieldRange(field)) ...
+    }
+
+    Decoding errors throw, unless the range was given a DecodeError. Then the iteration stops at the error and the error is stored there.
+ */
+class FieldRange
 {
-    ITEM_NAME = 1,
-    POKEMON_DETAILS = 2,
-    MOVE_DETAILS = 4,
-    POKEMON_TYPE_DETAILS = 8
+    Buffer buf;
+    const TagSet *wanted; // Fields to visit, NULL for all of them.
+    DecodeError *error; // Where to report errors, NULL to throw.
+
+public:
+    class iterator
+    {
+        ProtoBuf pb;
+        const TagSet *wanted;
+        DecodeError *error;
+        Message current;
+        bool atEnd;
+
+        void advance()
+        {
+            DecodeStatus status = DecodeStatus::OK;
+
+            if (wanted)
+            {
+                bool found;
+
+                status = pb.tryGetMessage(current, *wanted, found);
+                atEnd = !found;
+            }
+            else
+            {
+                atEnd = !pb.getBytesLeft();
+                if (!atEnd) status = pb.tryGetMessage(current);
+            }
+
+            if (status != DecodeStatus::OK)
+            {
+                atEnd = true;
+                if (!error) throwOnError(status);
+                error->set(status, pb.getErrorPtr());
+            }
+        }
+
+    public:
+        iterator(const Buffer &buf, const TagSet *wanted, DecodeError *error, bool atEnd) : pb(buf.buf, buf.n), wanted(wanted), error(error), atEnd(atEnd)
+        {
+            if (!atEnd) advance();
+        }
+
+        const Message &operator*() const {return current;}
+        const Message *operator->() const {return &current;}
+        iterator &operator++() {advance(); return *this;}
+        bool operator!=(const iterator &other) const {return atEnd != other.atEnd;}
+    };
+
+    FieldRange(const uint8_t *buf, size_t n, const TagSet *wanted = NULL, DecodeError *error = NULL) : wanted(wanted), error(error)
+    {
+        this->buf.buf = buf;
+        this->buf.n = n;
+    }
+
+    /* Fields of a length prefixed message or a group. */
+    FieldRange(const Message &msg) : wanted(NULL), error(NULL)
+    {
+        init(msg);
+    }
+
+    FieldRange(const Message &msg, const TagSet &wanted) : wanted(&wanted), error(NULL)
+    {
+        init(msg);
+    }
+
+    FieldRange(const Message &msg, const TagSet &wanted, DecodeError &error) : wanted(&wanted), error(&error)
+    {
+        init(msg);
+    }
+
+    iterator begin() const {return iterator(buf, wanted, error, false);}
+    iterator end() const {return iterator(buf, wanted, error, true);}
+
+private:
+    void init(const Message &msg)
+    {
+        if ((msg.type != WireType::LENGTH_PREFIXED) && (msg.type != WireType::START_GROUP)) throw InvalidArgumentException("Not a length prefixed message or group.");
+
+        buf = msg.data.subMessage;
+    }
 };
 
-enum class PokemonDetailsTag
+template <int... I>
+struct IntSequence {};
+
+/* IntSequence<0, 1, ..., N - 1> */
+template <int N, int... I>
+struct MakeIntSequence : MakeIntSequence<N - 1, N - 1, I...> {};
+
+template <int... I>
+struct MakeIntSequence<0, I...>
 {
-    PRIMARY_TYPE = 4,
-    SECONDARY_TYPE = 5,
-    BASE_STATS = 8,
-    QUICK_MOVES = 9,
-    CHARGED_MOVES = 10
+    typedef IntSequence<I...> type;
 };
 
-enum class BaseStatsTag
+/* Field decoders of the schemas, they store a value of the expected wire type into a member of S. Values of other wire types are ignored.
+    Decoding errors are stored in the DecodeError and returned.
+ */
+
+/* Varint into an integer member. */
+template <typename S, typename T, T S::*member>
+struct VarIntMember
 {
-    STAMINA = 1,
-    ATTACK = 2,
-    DEFENSE = 3
+    static DecodeStatus decode(S &s, const Message &msg, DecodeError &)
+    {
+        if (msg.type == WireType::VARINT) s.*member = (T)msg.data.varInt;
+
+        return DecodeStatus::OK;
+    }
 };
 
-enum class MoveDetailsTag
+/* Varint appended to a container member, for unpacked repeated fields. */
+template <typename S, typename C, C S::*member>
+struct RepeatedVarIntMember
 {
-    TYPE = 3,
-    POWER = 4,
-    DURATION = 12,
-    ENERGY = 15
+    static DecodeStatus decode(S &s, const Message &msg, DecodeError &)
+    {
+        if (msg.type == WireType::VARINT) (s.*member).push_back((typename C::value_type)msg.data.varInt);
+
+        return DecodeStatus::OK;
+    }
 };
 
-enum class TypeDetailsTag
+/* Packed repeated varints appended to a container member. */
+template <typename S, typename C, C S::*member>
+struct PackedVarIntMember
 {
-    TYPE_CHART = 1,
-    ID = 2
+    static DecodeStatus decode(S &s, const Message &msg, DecodeError &error)
+    {
+        if (msg.type != WireType::LENGTH_PREFIXED) return DecodeStatus::OK;
+
+        ProtoBuf pb(msg);
+        DecodeStatus status = pb.tryReadPackedVarInts(s.*member);
+
+        return status == DecodeStatus::OK ? status : error.set(status, pb.getErrorPtr());
+    }
 };
 
-void addLegacyMove(
-    const char *pokemonName,
-    const char *moveName
-)
+/* Packed repeated fixed size values replacing the contents of a container member. */
+template <typename S, typename C, C S::*member>
+struct PackedFixedMember
 {
-    if (pokemonNameToId.find(pokemonName) == pokemonNameToId.end())
+    static DecodeStatus decode(S &s, const Message &msg, DecodeError &error)
     {
-        printf("No such pokemon: %s\n", pokemonName);
-        return;
+        if (msg.type != WireType::LENGTH_PREFIXED) return DecodeStatus::OK;
+
+        ProtoBuf pb(msg);
+
+        (s.*member).clear();
+        DecodeStatus status = pb.tryReadPackedFixed(s.*member);
+
+        return status == DecodeStatus::OK ? status : error.set(status, pb.getErrorPtr());
     }
-    if (moveNameToId.find(moveName) == moveNameToId.end())
+};
+
+/* 32 bit float into a float member. */
+template <typename S, float S::*member>
+struct FloatMember
+{
+    static DecodeStatus decode(S &s, const Message &msg, DecodeError &)
     {
-        printf("No such move: %s\n", moveName);
-        return;
+        if (msg.type == WireType::BIT32) s.*member = msg.getFloat();
+
+        return DecodeStatus::OK;
+    }
+};
+
+/* Submessage whose fields are decoded into the same struct by another schema. */
+template <typename S, typename FieldSchema>
+struct EmbeddedFields
+{
+    static DecodeStatus decode(S &s, const Message &msg, DecodeError &error)
+    {
+        if (msg.type != WireType::LENGTH_PREFIXED) return DecodeStatus::OK;
+
+        return FieldSchema::tryDecode(s, msg, error);
+    }
+};
+
+/* Any other conversion, done by a function. */
+template <typename S, DecodeStatus (*function)(S &, const Message &, DecodeError &)>
+struct CustomField
+{
+    static DecodeStatus decode(S &s, const Message &msg, DecodeError &error) {return function(s, msg, error);}
+};
+
+/* Maps a tag to a field decoder. */
+template <int Tag, typename Decoder>
+struct Field : Decoder
+{
+    static const int tag = Tag;
+};
+
+/* Declarative message decoder. The fields map tags to the members of S:
+
+    typedef Schema<MoveInfo,
+        Field<3, VarIntMember<MoveInfo, int, &MoveInfo::moveType>>,
+        Field<4, FloatMember<MoveInfo, &MoveInfo::power>>
+    > MoveSchema;
+
+    decode() dispatches by a jump table indexed by tag, generated at compile time. Fields with other tags are skipped unread.
+ */
+template <typename S, typename... Fields>
+class Schema
+{
+    typedef DecodeStatus (*Handler)(S &, const Message &, DecodeError &);
+
+    template <typename... Rest>
+    struct MaxTag
+    {
+        static const int value = 0;
+    };
+
+    template <typename F, typename... Rest>
+    struct MaxTag<F, Rest...>
+    {
+        static const int value = F::tag > MaxTag<Rest...>::value ? F::tag : MaxTag<Rest...>::value;
+    };
+
+    static_assert(MaxTag<Fields...>::value < 256, "Schema tags must fit a TagSet.");
+
+    /* Decoder of the tag, NULL if no field has it. */
+    template <int Tag, typename... Rest>
+    struct HandlerOf
+    {
+        static constexpr Handler get() {return NULL;}
+    };
+
+    template <int Tag, typename F, typename... Rest>
+    struct HandlerOf<Tag, F, Rest...>
+    {
+        static constexpr Handler get() {return F::tag == Tag ? &F::decode : HandlerOf<Tag, Rest...>::get();}
+    };
+
+    template <int... I>
+    static const Handler *makeTable(IntSequence<I...>)
+    {
+        static const Handler handlers[] = {HandlerOf<I, Fields...>::get()...};
+
+        return handlers;
+    }
+
+public:
+    /* Decodes the fields into s, returns the first error. */
+    static DecodeStatus tryDecode(S &s, const Message &msg, DecodeError &error)
+    {
+        static const TagSet tags = {Fields::tag...};
+        static const Handler *handlers = makeTable(typename MakeIntSequence<MaxTag<Fields...>::value + 1>::type());
+
+        for (const Message &field : FieldRange(msg, tags, error))
+        {
+            DecodeStatus status = handlers[field.tag](s, field, error);
+
+            if (status != DecodeStatus::OK) return status;
+        }
+
+        return error.status;
+    }
+
+    static void decode(S &s, const Message &msg)
+    {
+        DecodeError error;
+
+        throwOnError(tryDecode(s, msg, error));
+    }
+};
+
+/* To dump message for debugging. */
+void dumpMessage(const Message &msg)
+{
+    printf("Message tag: %d\n", msg.tag);
+    printf("Message type: %d\n", (int)msg.type);
+
+    switch (msg.type)
+    {
+        case WireType::LENGTH_PREFIXED:
+            printf("%zd bytes long submessage.\n", msg.data.subMessage.n);
+            break;
+        case WireType::START_GROUP:
+            printf("%zd bytes long group.\n", msg.data.subMessage.n);
+            break;
+        case WireType::VARINT:
+            printf("Varint: %llu\n", (unsigned long long)msg.data.varInt);
+            break;
+        case WireType::BIT32:
+            printf("32 bit data: ");
+            for (int i = 0; i < 4; i++) printf("%02x ", msg.data.fixed[i]);
+            printf("\n");
+            break;
+        case WireType::BIT64:
+            printf("64 bit data: ");
+            for (int i = 0; i < 8; i++) printf("%02x ", msg.data.fixed[i]);
+            printf("\n");
+            break;
+        default:;
+    }
+}
+
+/* Output buffered in large blocks, for writers emitting lots of small pieces. */
+class BufferedWriter
+{
+    FILE *f;
+    std::vector<char> buffer;
+    size_t used;
+    bool error;
+
+    void writeSlow(const char *s, size_t n)
+    {
+        flush();
+        if (n > buffer.size())
+        {
+            if (fwrite(s, 1, n, f) != n) error = true;
+            return;
+        }
+        memcpy(&buffer[0], s, n);
+        used = n;
+    }
+
+public:
+    BufferedWriter(FILE *f, size_t size = 256 * 1024) : f(f), buffer(size), used(0), error(false) {}
+    ~BufferedWriter() {flush();}
+
+    void write(const char *s, size_t n)
+    {
+        if (n > buffer.size() - used) return writeSlow(s, n);
+
+        memcpy(&buffer[used], s, n);
+        used += n;
+    }
+
+    void put(char c)
+    {
+        if (used == buffer.size()) flush();
+        buffer[used++] = c;
+    }
+
+    /* String literals, their length is known at compile time. */
+    template <size_t N>
+    void puts(const char (&s)[N]) {write(s, N - 1);}
+
+    void writeUInt(uint64_t value)
+    {
+        char digits[20];
+        char *p = digits + sizeof(digits);
+
+        do
+        {
+            *--p = '0' + value % 10;
+            value /= 10;
+        } while (value);
+
+        write(p, digits + sizeof(digits) - p);
+    }
+
+    /* Bytes as lowercase hex digits. */
+    void writeHex(const uint8_t *bytes, size_t n)
+    {
+        static const char hexDigits[] = "0123456789abcdef";
+
+        for (size_t i = 0; i < n; i++)
+        {
+            put(hexDigits[bytes[i] >> 4]);
+            put(hexDigits[bytes[i] & 15]);
+        }
+    }
+
+    /* Shortest %g form that reads back the same value. */
+    void writeFloat(float value)
+    {
+        char tmp[32];
+        int n = 0;
+
+        for (int precision = 6; precision <= 9; precision++)
+        {
+            n = snprintf(tmp, sizeof(tmp), "%.*g", precision, value);
+            if (strtof(tmp, NULL) == value) break;
+        }
+        write(tmp, n);
+    }
+
+    void writeDouble(double value)
+    {
+        char tmp[32];
+        int n = 0;
+
+        for (int precision = 15; precision <= 17; precision++)
+        {
+            n = snprintf(tmp, sizeof(tmp), "%.*g", precision, value);
+            if (strtod(tmp, NULL) == value) break;
+        }
+        write(tmp, n);
+    }
+
+    /* Two spaces for each level. */
+    void indent(int depth)
+    {
+        static const char spaces[] = "                                                                ";
+
+        for (size_t n = 2 * depth; n; )
+        {
+            size_t chunk = std::min(n, sizeof(spaces) - 1);
+
+            write(spaces, chunk);
+            n -= chunk;
+        }
+    }
+
+    /* Returns false if a write has failed. */
+    bool flush()
+    {
+        if (used && (fwrite(&buffer[0], 1, used, f) != used)) error = true;
+        used = 0;
+
+        return !error;
+    }
+};
+
+/* Dumps protobuf data without a schema, as an indented text tree or JSON.
+    The contents of a length prefixed field are guessed in this order: UTF-8 text is a string, data parsing as fields to the end is a message, then packed floats, packed varints and raw bytes when nothing else fits.
+    Floats are only guessed when every value is 0 or has a magnitude between 1e-6 and 1e9, varint lists rarely pass that.
+ */
+class ProtoDumper
+{
+    enum class Guess
+    {
+        STRING,
+        MESSAGE,
+        FLOATS,
+        VARINTS,
+        BYTES
+    };
+
+    static const int MAX_DEPTH = 64; // Deeper messages are dumped as bytes.
+
+    BufferedWriter &out;
+    bool json;
+
+    static bool isText(const uint8_t *p, size_t n)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            uint8_t c = p[i];
+
+            if (c < 0x80)
+            {
+                if ((c < 0x20) && (c != '\t') && (c != '\n') && (c != '\r')) return false;
+                if (c == 0x7f) return false;
+                continue;
+            }
+
+            // Multi byte UTF-8 sequence
+            size_t len = (c >= 0xc2 && c < 0xe0) ? 2 : (c >= 0xe0 && c < 0xf0) ? 3 : (c >= 0xf0 && c < 0xf5) ? 4 : 0;
+
+            if (!len || (len > n - i)) return false;
+            for (size_t j = 1; j < len; j++)
+            {
+                if ((p[i + j] & 0xc0) != 0x80) return false;
+            }
+            i += len - 1;
+        }
+
+        return true;
     }
 
-    const MoveInfo &moveInfo = moveList[moveNameToId[moveName]];
+    static bool isMessage(const uint8_t *p, size_t n)
+    {
+        ProtoBuf pb(p, n);
+
+        while (pb.getBytesLeft())
+        {
+            Message msg;
+
+            if (pb.tryGetMessage(msg) != DecodeStatus::OK) return false;
+            if ((msg.tag <= 0) || (msg.tag >= (1 << 29))) return false;
+            if ((msg.type != WireType::VARINT) && (msg.type != WireType::BIT32) && (msg.type != WireType::BIT64)
+                && (msg.type != WireType::LENGTH_PREFIXED) && (msg.type != WireType::START_GROUP)) return false;
+        }
+
+        return true;
+    }
+
+    static bool isFloats(const uint8_t *p, size_t n)
+    {
+        if (n % 4) return false;
+
+        for (size_t i = 0; i < n; i += 4)
+        {
+            float value;
+
+            memcpy(&value, p + i, 4);
+            if ((value != 0) && !((fabs(value) >= 1e-6) && (fabs(value) <= 1e9))) return false;
+        }
+
+        return true;
+    }
+
+    static bool isVarInts(const uint8_t *p, size_t n)
+    {
+        ProtoBuf pb(p, n);
+
+        if (p[n - 1] & 0x80) return false;
+        while (pb.getBytesLeft())
+        {
+            uint64_t value;
+
+            if (pb.tryReadVarInt(value) != DecodeStatus::OK) return false;
+        }
+
+        return true;
+    }
+
+    static Guess guess(const uint8_t *p, size_t n, int depth)
+    {
+        if (isText(p, n)) return Guess::STRING;
+        if ((depth < MAX_DEPTH) && isMessage(p, n)) return Guess::MESSAGE;
+        if (isFloats(p, n)) return Guess::FLOATS;
+        if (isVarInts(p, n)) return Guess::VARINTS;
+
+        return Guess::BYTES;
+    }
+
+    /* Control characters other than tabs and line breaks aren't guessed as text, so only these need escaping. */
+    void writeString(const uint8_t *p, size_t n)
+    {
+        size_t start = 0;
+
+        out.put('"');
+        for (size_t i = 0; i < n; i++)
+        {
+            uint8_t c = p[i];
+
+            if ((c >= 0x20) && (c != '"') && (c != '\\')) continue;
+
+            out.write((const char *)p + start, i - start);
+            switch (c)
+            {
+                case '\n': out.puts("\\n"); break;
+                case '\r': out.puts("\\r"); break;
+                case '\t': out.puts("\\t"); break;
+                default:
+                    out.put('\\');
+                    out.put(c);
+            }
+            start = i + 1;
+        }
+        out.write((const char *)p + start, n - start);
+        out.put('"');
+    }
+
+    /* JSON has no infinities and NaNs. */
+    void writeFloat(float value)
+    {
+        if (json && !std::isfinite(value)) out.puts("null");
+        else out.writeFloat(value);
+    }
+
+    void writeDouble(double value)
+    {
+        if (json && !std::isfinite(value)) out.puts("null");
+        else out.writeDouble(value);
+    }
+
+    /* Starts a field, "tag: " or {"tag": N, "kind": */
+    template <size_t N>
+    void beginField(const Message &msg, const char (&kind)[N], int depth)
+    {
+        out.indent(depth);
+        if (json)
+        {
+            out.puts("{\"tag\": ");
+            out.writeUInt(msg.tag);
+            out.puts(", \"");
+            out.puts(kind);
+            out.puts("\": ");
+        }
+        else
+        {
+            out.writeUInt(msg.tag);
+            out.puts(": ");
+        }
+    }
+
+    void writeFields(const uint8_t *p, size_t n, int depth)
+    {
+        ProtoBuf pb(p, n);
+        bool first = true;
+
+        while (pb.getBytesLeft())
+        {
+            Message msg;
+
+            pb.tryGetMessage(msg); // Checked by isMessage().
+            if (json && !first) out.puts(",\n");
+            writeField(msg, depth);
+            if (!json) out.put('\n');
+            first = false;
+        }
+        if (json && !first) out.put('\n');
+    }
+
+    /* A message or a group, "tag {...}" or {"tag": N, "message": [...]} */
+    template <size_t N>
+    void writeMessage(const Message &msg, const char (&kind)[N], int depth)
+    {
+        const Buffer &contents = msg.data.subMessage;
+
+        if (json)
+        {
+            beginField(msg, kind, depth);
+            out.puts("[\n");
+            writeFields(contents.buf, contents.n, depth + 1);
+            out.indent(depth);
+            out.puts("]}");
+        }
+        else
+        {
+            out.indent(depth);
+            out.writeUInt(msg.tag);
+            if (msg.type == WireType::START_GROUP) out.puts(" (group) {\n");
+            else out.puts(" {\n");
+            writeFields(contents.buf, contents.n, depth + 1);
+            out.indent(depth);
+            out.put('}');
+        }
+    }
+
+    void writeLengthPrefixed(const Message &msg, int depth)
+    {
+        const uint8_t *p = msg.data.subMessage.buf;
+        size_t n = msg.data.subMessage.n;
+
+        switch (n ? guess(p, n, depth) : Guess::STRING)
+        {
+            case Guess::STRING:
+                beginField(msg, "string", depth);
+                writeString(p, n);
+                break;
+            case Guess::MESSAGE:
+                writeMessage(msg, "message", depth);
+                return;
+            case Guess::FLOATS:
+                beginField(msg, "floats", depth);
+                out.put('[');
+                for (size_t i = 0; i < n; i += 4)
+                {
+                    float value;
+
+                    memcpy(&value, p + i, 4);
+                    if (i) out.puts(", ");
+                    writeFloat(value);
+                }
+                out.put(']');
+                break;
+            case Guess::VARINTS:
+            {
+                ProtoBuf pb(p, n);
+                bool first = true;
+
+                beginField(msg, "varints", depth);
+                out.put('[');
+                while (pb.getBytesLeft())
+                {
+                    uint64_t value;
+
+                    pb.tryReadVarInt(value);
+                    if (!first) out.puts(", ");
+                    out.writeUInt(value);
+                    first = false;
+                }
+                out.put(']');
+                break;
+            }
+            case Guess::BYTES:
+                beginField(msg, "bytes", depth);
+                out.put(json ? '"' : '<');
+                out.writeHex(p, n);
+                out.put(json ? '"' : '>');
+                break;
+        }
+        if (json) out.put('}');
+    }
+
+    void writeField(const Message &msg, int depth)
+    {
+        switch (msg.type)
+        {
+            case WireType::VARINT:
+                beginField(msg, "varint", depth);
+                out.writeUInt(msg.data.varInt);
+                if (json) out.put('}');
+                break;
+            case WireType::BIT32:
+                beginField(msg, "fixed32", depth);
+                if (json)
+                {
+                    uint32_t value;
+
+                    memcpy(&value, msg.data.fixed, 4);
+                    out.writeUInt(value);
+                    out.puts(", \"float\": ");
+                    writeFloat(msg.getFloat());
+                    out.put('}');
+                }
+                else
+                {
+                    out.puts("0x");
+                    for (int i = 3; i >= 0; i--) out.writeHex(msg.data.fixed + i, 1);
+                    out.puts(" (float ");
+                    writeFloat(msg.getFloat());
+                    out.put(')');
+                }
+                break;
+            case WireType::BIT64:
+                beginField(msg, "fixed64", depth);
+                if (json)
+                {
+                    uint64_t value;
+
+                    memcpy(&value, msg.data.fixed, 8);
+                    out.writeUInt(value);
+                    out.puts(", \"double\": ");
+                    writeDouble(msg.getDouble());
+                    out.put('}');
+                }
+                else
+                {
+                    out.puts("0x");
+                    for (int i = 7; i >= 0; i--) out.writeHex(msg.data.fixed + i, 1);
+                    out.puts(" (double ");
+                    writeDouble(msg.getDouble());
+                    out.put(')');
+                }
+                break;
+            case WireType::LENGTH_PREFIXED:
+                writeLengthPrefixed(msg, depth);
+                break;
+            case WireType::START_GROUP:
+                if (depth < MAX_DEPTH)
+                {
+                    writeMessage(msg, "group", depth);
+                }
+                else
+                {
+                    beginField(msg, "group", depth);
+                    out.put(json ? '"' : '<');
+                    out.writeHex(msg.data.subMessage.buf, msg.data.subMessage.n);
+                    out.put(json ? '"' : '>');
+                    if (json) out.put('}');
+                }
+                break;
+            default:;
+        }
+    }
+
+public:
+    ProtoDumper(BufferedWriter &out, bool json) : out(out), json(json) {}
+
+    /* Dumps the top level fields. Stops at malformed data, the error tells where it is. */
+    DecodeStatus dump(const uint8_t *buf, size_t n, DecodeError &error)
+    {
+        bool first = true;
+
+        if (json) out.puts("[\n");
+        for (const Message &msg : FieldRange(buf, n, NULL, &error))
+        {
+            if (json && !first) out.puts(",\n");
+            writeField(msg, json ? 1 : 0);
+            if (!json) out.put('\n');
+            first = false;
+        }
+        if (json && first) out.puts("]\n");
+        else if (json) out.puts("\n]\n");
+
+        return error.status;
+    }
+};
+
+/* Builds protobuf data, the counterpart of ProtoBuf.
+    Ranges of an existing buffer can be referenced instead of copied, so re-emitting a large file with a few changed records costs little more than writing it out.
+    Referenced buffers must outlive the encoder.
+ */
+class ProtoEncoder
+{
+    struct Piece
+    {
+        const uint8_t *buf; // Referenced bytes, NULL for the encoder's own bytes.
+        size_t start; // Offset in bytes for own bytes.
+        size_t n;
+    };
+
+    std::vector<uint8_t> bytes; // Encoded bytes.
+    std::vector<Piece> pieces;
+    size_t size;
+
+    void append(const uint8_t *p, size_t n)
+    {
+        if (pieces.empty() || pieces.back().buf) pieces.push_back(Piece{NULL, bytes.size(), 0});
+        bytes.insert(bytes.end(), p, p + n);
+        pieces.back().n += n;
+        size += n;
+    }
+
+public:
+    ProtoEncoder() : size(0) {}
+
+    void writeVarInt(uint64_t value)
+    {
+        uint8_t encoded[10];
+        size_t n = 0;
+
+        while (value >= 0x80)
+        {
+            encoded[n++] = (uint8_t)value | 0x80;
+            value >>= 7;
+        }
+        encoded[n++] = (uint8_t)value;
+
+        append(encoded, n);
+    }
+
+    void writeKey(int tag, WireType type) {writeVarInt(((uint64_t)tag << 3) | (uint64_t)type);}
+
+    void writeBytes(const uint8_t *p, size_t n) {append(p, n);}
+
+    /* Adds the bytes without copying them. */
+    void reference(const uint8_t *p, size_t n)
+    {
+        if (!n) return;
+
+        if (!pieces.empty() && pieces.back().buf && (pieces.back().buf + pieces.back().n == p)) pieces.back().n += n;
+        else pieces.push_back(Piece{p, 0, n});
+        size += n;
+    }
+
+    /* A field with the value of the message. Length prefixed values are copied. */
+    void writeField(const Message &msg)
+    {
+        writeKey(msg.tag, msg.type);
+        switch (msg.type)
+        {
+            case WireType::VARINT: writeVarInt(msg.data.varInt); break;
+            case WireType::BIT32: writeBytes(msg.data.fixed, 4); break;
+            case WireType::BIT64: writeBytes(msg.data.fixed, 8); break;
+            case WireType::LENGTH_PREFIXED:
+                writeVarInt(msg.data.subMessage.n);
+                writeBytes(msg.data.subMessage.buf, msg.data.subMessage.n);
+                break;
+            default: throw InvalidArgumentException("Unsupported wire type.");
+        }
+    }
+
+    /* A length prefixed field holding what the other encoder has built. Its references stay references. */
+    void writeMessage(int tag, const ProtoEncoder &msg)
+    {
+        writeKey(tag, WireType::LENGTH_PREFIXED);
+        writeVarInt(msg.size);
+        for (const Piece &piece : msg.pieces)
+        {
+            if (piece.buf) reference(piece.buf, piece.n);
+            else append(&msg.bytes[piece.start], piece.n);
+        }
+    }
+
+    size_t getSize() const {return size;}
+
+    /* Copies the encoded data into one buffer. */
+    std::vector<uint8_t> flatten() const
+    {
+        std::vector<uint8_t> result;
+
+        result.reserve(size);
+        for (const Piece &piece : pieces)
+        {
+            const uint8_t *p = piece.buf ? piece.buf : &bytes[piece.start];
+
+            result.insert(result.end(), p, p + piece.n);
+        }
+
+        return result;
+    }
+
+    /* Writes the pieces in order, returns false on errors. */
+    bool write(FILE *f) const
+    {
+        for (const Piece &piece : pieces)
+        {
+            const uint8_t *p = piece.buf ? piece.buf : &bytes[piece.start];
+
+            if (fwrite(p, 1, piece.n, f) != piece.n) return false;
+        }
+
+        return true;
+    }
+};
+
+/* Bump allocator for data that is released all at once.
+    Allocations are carved from large chunks, nothing is freed until the arena is destroyed.
+    Not thread safe, each analysis has its own.
+ */
+class Arena
+{
+    struct Chunk
+    {
+        Chunk *next;
+        size_t size;
+        size_t used;
+    };
+
+    Chunk *head; // Chunk small allocations are taken from.
+    size_t nextChunkSize;
+
+    static const size_t MAX_CHUNK_SIZE = 16 * 1024 * 1024;
+
+    static uint8_t *chunkData(Chunk *chunk) {return (uint8_t *)(chunk + 1);}
+
+    Chunk *newChunk(size_t size)
+    {
+        Chunk *chunk = (Chunk *)malloc(sizeof(Chunk) + size);
+        if (!chunk) throw std::bad_alloc();
+
+        chunk->size = size;
+        chunk->used = 0;
+
+        return chunk;
+    }
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+public:
+    Arena(size_t firstChunkSize = 64 * 1024)
+    {
+        head = NULL;
+        nextChunkSize = firstChunkSize;
+    }
+
+    ~Arena()
+    {
+        while (head)
+        {
+            Chunk *next = head->next;
+            free(head);
+            head = next;
+        }
+    }
+
+    void *allocate(size_t size, size_t align)
+    {
+        if (head)
+        {
+            size_t offset = (head->used + align - 1) & ~(align - 1);
+
+            if (offset + size <= head->size)
+            {
+                head->used = offset + size;
+                return chunkData(head) + offset;
+            }
+        }
+
+        if (size > nextChunkSize / 4)
+        {
+            // Big allocations get their own chunk behind the current one, so the space left in the head is not wasted.
+            Chunk *chunk = newChunk(size);
+
+            chunk->used = size;
+            if (head)
+            {
+                chunk->next = head->next;
+                head->next = chunk;
+            }
+            else
+            {
+                chunk->next = NULL;
+                head = chunk;
+            }
+            return chunkData(chunk);
+        }
+
+        Chunk *chunk = newChunk(nextChunkSize);
+
+        chunk->next = head;
+        chunk->used = size;
+        head = chunk;
+        if (nextChunkSize < MAX_CHUNK_SIZE) nextChunkSize *= 2;
+
+        return chunkData(chunk);
+    }
+};
+
+/* Standard allocator on top of an arena. Without an arena it uses the heap.
+    Moved containers keep the arena, copies go to the heap, so copying out of a shared arena never allocates from it.
+ */
+template <typename T>
+struct ArenaAllocator
+{
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    Arena *arena;
+
+    ArenaAllocator(Arena *arena = NULL) : arena(arena) {}
+    template <typename U> ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) {}
+
+    T *allocate(size_t n)
+    {
+        if (!arena) return (T *)::operator new(n * sizeof(T));
+
+        return (T *)arena->allocate(n * sizeof(T), alignof(T));
+    }
+
+    void deallocate(T *p, size_t)
+    {
+        if (!arena) ::operator delete(p);
+    }
+
+    ArenaAllocator select_on_container_copy_construction() const {return ArenaAllocator();}
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) {return a.arena == b.arena;}
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) {return a.arena != b.arena;}
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+template <typename K, typename V>
+using ArenaMap = std::map<K, V, std::less<K>, ArenaAllocator<std::pair<const K, V>>>;
+
+/* Represents the info about the pokémon. */
+struct PokemonInfo
+{
+    int id;
+    std::string name;
+    int baseAtk;
+    int baseDef;
+    int baseStamina;
+    ArenaVector<int> fastMoves; // Ids of fast moves
+    ArenaVector<int> chargedMoves; // Ids of charged moves
+    size_t nAvailableFastMoves;
+    size_t nAvailableChargedMoves;
+
+    ArenaVector<int> pokemonTypes; // Ids of the two pokémon types.
+    //------ Computed info
+    double maxCP;
+    double tankiness; // base attack times base defense (perfect IV assumed)
+    double trueStrength; // product of all the 3 base stats.  (perfect IV assumed)
+    double prestigerCPMultiplier;
+};
+
+/* Info about the moves. */
+struct MoveInfo
+{
+    int id;
+    std::string name;
+    float power;
+    double duration; // In seconds
+    int energy;
+    int moveType;
+    // --------
+    double eps; // Energy per second
+    double dps; // Damage per second
+    double dpe; // Damage per energy
+};
+
+/* Appends printf formatted text to the string. */
+void appendFormat(std::string &out, const char *format, ...)
+{
+    char line[256];
+    va_list args;
+    va_list retry;
+
+    va_start(args, format);
+    va_copy(retry, args);
+
+    int n = vsnprintf(line, sizeof(line), format, args);
+
+    if ((n >= 0) && ((size_t)n < sizeof(line)))
+    {
+        out.append(line, n);
+    }
+    else if (n > 0)
+    {
+        std::vector<char> longLine(n + 1);
+
+        vsnprintf(longLine.data(), longLine.size(), format, retry);
+        out.append(longLine.data(), n);
+    }
+    va_end(retry);
+    va_end(args);
+}
+
+std::string removeFast(const std::string &name)
+{
+    std::string result = name;
+
+    for (int i = 0; i < 5; i++) result.pop_back();
+
+    return result;
+}
+
+std::string normalizeName(const std::string &name)
+{
+    std::string result;
+
+    for (size_t i = 0; i < name.size(); i++)
+    {
+        if (i == 0) result.push_back(name[i]);
+        else if (name[i] == '_') result.push_back(' ');
+        else result.push_back(name[i] + 32);
+    }
+
+    return result;
+}
+
+enum class PogoProtoTag
+{
+    ITEM_TEMPLATE = 2,
+};
+
+enum class ItemTemplateTag
+{
+    ITEM_NAME = 1,
+    POKEMON_DETAILS = 2,
+    MOVE_DETAILS = 4,
+    POKEMON_TYPE_DETAILS = 8
+};
+
+enum class PokemonDetailsTag
+{
+    PRIMARY_TYPE = 4,
+    SECONDARY_TYPE = 5,
+    BASE_STATS = 8,
+    QUICK_MOVES = 9,
+    CHARGED_MOVES = 10
+};
+
+enum class BaseStatsTag
+{
+    STAMINA = 1,
+    ATTACK = 2,
+    DEFENSE = 3
+};
+
+enum class MoveDetailsTag
+{
+    TYPE = 3,
+    POWER = 4,
+    DURATION = 12,
+    ENERGY = 15
+};
+
+enum class TypeDetailsTag
+{
+    TYPE_CHART = 1,
+    ID = 2
+};
+
+const double LEVEL30_CP_MULTIPLIER = 0.7317;
+const double LEVEL40_CP_MULTIPLIER = 0.79030001;
+const char *POKEMON_LIST_FILE = "pokemonlist.txt";
+const char *MOVE_LIST_FILE= "moves.txt";
+const char *DUMP_TEXT_FILE = "dump.txt";
+const char *DUMP_JSON_FILE = "dump.json";
+
+const double ATTACKER_CPM = LEVEL30_CP_MULTIPLIER; // Corresponding CP multiplier for level 30 pokémon.
+
+/* Output of -dump */
+enum class DumpFormat
+{
+    NONE, // Run the analysis.
+    TEXT,
+    JSON
+};
+
+/* How the counter reports are written, see -output. */
+enum class OutputMethod
+{
+    STDIO,
+    PWRITE,
+    URING
+};
+
+struct Config
+{
+    const char *gameMasterFile;
+    double roundLength; // How often the opponent strikes.
+    double lifeTime; // How long life assumed.
+    double battleTime; // Length of the battle;
+    double prestigerCP; // The desired CP of the prestiger.
+    const char *filteredPokemon; // List of pokemon to filter out. eg. legendaries or other unobtainable stuff.
+    const char *legacyMoves; // File containing legacy moves.
+    const char *highlightPokemonName; // Pokemon to highlight and write more stats to stdout when dumping.
+    bool verbose; // Print progress and warnings to stdout.
+    bool printTimes; // Print the time spent in each phase.
+    bool pruneDominated; // Leave movesets out of the counter lists that are beaten by another moveset of the same pokémon.
+    bool writeFrontier; // Write the Pareto frontier of DPS versus bulk and prestige.
+    bool writeCounterFrontiers; // Write the frontiers for each type pair too.
+    int teamTopN; // Search the smallest team with a top N counter against every type pair, 0 to skip.
+    const char *query; // Filtered counter query to print, see -query.
+    const char *zipEntry; // Game master entry of a zip archive, NULL to look it up by name.
+    DumpFormat dump; // Dump the game master without a schema instead of the analysis.
+    const char *patchFile; // Changes to the move and base stats of the game master.
+    const char *outputFile; // Write the (patched) game master here instead of the analysis.
+    const char *cacheDir; // Directory of the results of earlier runs, NULL to always simulate.
+    OutputMethod output;
+    int gzipLevel; // Compress the counter reports at this level, 0 to write them as text.
+
+    Config()
+    {
+        gameMasterFile = NULL;
+        roundLength = 2.5;
+        lifeTime = 100;
+        battleTime = 100;
+        prestigerCP = 1500;
+        filteredPokemon = NULL;
+        legacyMoves = NULL;
+        highlightPokemonName = NULL;
+        verbose = true;
+        printTimes = false;
+        pruneDominated = false;
+        writeFrontier = false;
+        writeCounterFrontiers = false;
+        teamTopN = 0;
+        query = NULL;
+        zipEntry = NULL;
+        dump = DumpFormat::NONE;
+        patchFile = NULL;
+        outputFile = NULL;
+        cacheDir = NULL;
+        output = OutputMethod::STDIO;
+        gzipLevel = 0;
+    }
+};
+
+/* The type chart as 1 byte codes into a table of the distinct multipliers.
+    Single and dual type multipliers only take a handful of values, so the codes of every attack type against every defender type pair fit in a few KB.
+ */
+struct EffectivenessCodes
+{
+    size_t nTypes;
+    size_t nPairs;
+    ArenaMap<int, int> typeIndex; // Dense index of each type id.
+    ArenaVector<std::pair<int, int>> pairTypes; // Types of each defender pair, t1 <= t2, in type id order.
+    ArenaVector<int> pairIndex; // Index of the pair of two dense type indexes, in either order.
+    ArenaVector<double> multipliers; // Distinct multipliers, at most 256.
+    ArenaVector<uint8_t> codes; // A row of nPairs codes for each attack type.
+    ArenaVector<uint8_t> unknownRow; // Codes of multiplier 0 against each pair, for attack types without a type template.
+
+    EffectivenessCodes(Arena *arena) :
+        nTypes(0), nPairs(0),
+        typeIndex(ArenaAllocator<int>(arena)), pairTypes(arena), pairIndex(arena), multipliers(arena), codes(arena), unknownRow(arena)
+    {
+    }
+
+    void build(const ArenaMap<int, ArenaVector<float>> &typeChart)
+    {
+        std::map<double, uint8_t> multiplierCodes;
+
+        auto codeOf = [this, &multiplierCodes](double multiplier) -> uint8_t
+        {
+            auto it = multiplierCodes.find(multiplier);
+            if (it == multiplierCodes.end())
+            {
+                if (multipliers.size() > std::numeric_limits<uint8_t>::max()) throw InvalidMessageException();
+
+                it = multiplierCodes.insert(std::make_pair(multiplier, (uint8_t)multipliers.size())).first;
+                multipliers.push_back(multiplier);
+            }
+
+            return it->second;
+        };
+
+        auto effectiveness = [&typeChart](int attackType, int defenderType) -> double
+        {
+            const ArenaVector<float> &row = typeChart.at(attackType);
+
+            return ((defenderType < 1) || ((size_t)defenderType > row.size())) ? 0 : row[defenderType - 1];
+        };
+
+        for (const auto &t : typeChart) typeIndex[t.first] = nTypes++;
+
+        pairIndex.assign(nTypes * nTypes, 0);
+        for (const auto &t1 : typeChart)
+        {
+            for (const auto &t2 : typeChart)
+            {
+                if (t1.first > t2.first) continue;
+
+                pairIndex[typeIndex[t1.first] * nTypes + typeIndex[t2.first]] = nPairs;
+                pairIndex[typeIndex[t2.first] * nTypes + typeIndex[t1.first]] = nPairs;
+                pairTypes.push_back(std::make_pair(t1.first, t2.first));
+                nPairs++;
+            }
+        }
+
+        codes.reserve(nTypes * nPairs);
+        for (const auto &attack : typeChart)
+        {
+            for (const auto &pair : pairTypes)
+            {
+                // Single typed defenders are stored as a pair of the same type.
+                double multiplier = effectiveness(attack.first, pair.first);
+                if (pair.first != pair.second) multiplier *= effectiveness(attack.first, pair.second);
+
+                codes.push_back(codeOf(multiplier));
+            }
+        }
+
+        // Moves of a type missing from the type chart deal no counter damage, as with an empty row of the chart.
+        unknownRow.assign(nPairs, codeOf(0));
+    }
+
+    /* Codes of the attack type against each pair, all of multiplier 0 for unknown types. */
+    const uint8_t *getRow(int attackType) const
+    {
+        auto it = typeIndex.find(attackType);
+
+        return it == typeIndex.end() ? unknownRow.data() : &codes[it->second * nPairs];
+    }
+
+    /* Multiplier of the attack type against the defender types, 0 for unknown types. */
+    double getMultiplier(int attackType, int t1, int t2) const
+    {
+        auto i1 = typeIndex.find(t1);
+        auto i2 = typeIndex.find(t2);
+        const uint8_t *row = getRow(attackType);
+
+        if ((i1 == typeIndex.end()) || (i2 == typeIndex.end())) return 0;
+
+        return multipliers[row[pairIndex[i1->second * nTypes + i2->second]]];
+    }
+};
+
+/* Data parsed from the game master.
+    It's not modified after loading, so any number of analyses can share it.
+ */
+struct GameData
+{
+    Arena arena; // Holds the parsed data, must be the first member.
+
+    ArenaMap<int, PokemonInfo> pokemonList; // List of pokémon
+    ArenaMap<int, MoveInfo> moveList; // List of moves
+    ArenaMap<int, std::string> typeNames; // Names of types
+    ArenaMap<int, ArenaVector<float>> typeChart; // Type chart, a row of multipliers against each defender type, type id i at i - 1.
+    EffectivenessCodes effectiveness; // The type chart for scoring counters.
+
+    ArenaMap<std::string, int> pokemonNameToId; // Map pokémon names to Ids.
+    ArenaMap<std::string, int> moveNameToId; // Map moves to Ids.
+
+    GameData() :
+        pokemonList(ArenaAllocator<int>(&arena)),
+        moveList(ArenaAllocator<int>(&arena)),
+        typeNames(ArenaAllocator<int>(&arena)),
+        typeChart(ArenaAllocator<int>(&arena)),
+        effectiveness(&arena),
+        pokemonNameToId(ArenaAllocator<int>(&arena)),
+        moveNameToId(ArenaAllocator<int>(&arena))
+    {
+    }
+
+    const MoveInfo &getMove(int id) const {return moveList.at(id);}
+
+    /* Returns empty string for unknown types. */
+    const char *getTypeName(int id) const
+    {
+        auto it = typeNames.find(id);
+
+        return it == typeNames.end() ? "" : it->second.c_str();
+    }
+
+    /* Damage multiplier of the attack type against the defender type. */
+    float getEffectiveness(int attackType, int defenderType) const
+    {
+        auto row = typeChart.find(attackType);
+        if (row == typeChart.end()) return 0;
+        if ((defenderType < 1) || ((size_t)defenderType > row->second.size())) return 0;
+
+        return row->second[defenderType - 1];
+    }
+};
+
+/* State of a single analysis run.
+    The game data is shared read only, everything that depends on the configuration lives here.
+ */
+struct AnalysisContext
+{
+    const GameData &gameData;
+    Config conf;
+
+    std::map<std::string, bool> filtered; // Pokémon to ignore in the calculations.
+    std::map<int, PokemonInfo> pokemonList; // Pokémon taking part in the analysis with legacy moves added.
+
+    AnalysisContext(const GameData &gameData, const Config &conf) : gameData(gameData), conf(conf) {}
+
+    const PokemonInfo &getPokemon(int id) const {return pokemonList.at(id);}
+};
+
+/* Pokémon + moveset tuple and their properties. */
+struct MovesetDPS
+{
+    int pokemonId;
+    int fastId;
+    int chargedId;
+    bool isLegacy;
+    bool dodging;
+    double DPS; // Moveset DPS * attack
+    double msDPS; // Moveset DPS
+    double truePower; // Moveset DPS * trueStrength
+    double prestigePower; // Moveset DPS * prestigePotential
+    int fastAttacksPerTurn;
+    int nChargedUsed;
+
+    static double dpsScore(double rawDPS, const PokemonInfo &pi) {return rawDPS * (pi.baseAtk + 15);}
+    static double truePowerScore(double rawDPS, const PokemonInfo &pi, bool dodging) {return rawDPS * pi.trueStrength * (dodging ? 1 : 0.25);}
+    static double prestigePowerScore(double prestigerDPS, const PokemonInfo &pi) {return prestigerDPS * pi.trueStrength * pow(pi.prestigerCPMultiplier, 3);}
+
+    void populate(double rawDPS, double prestigerDPS, const PokemonInfo &pi)
+    {
+        msDPS = rawDPS;
+        DPS = dpsScore(rawDPS, pi);
+        truePower = truePowerScore(rawDPS, pi, dodging);
+        prestigePower = prestigePowerScore(prestigerDPS, pi);
+    }
+
+    void printEntry(const AnalysisContext &ctx, FILE *f, double value) const
+    {
+        std::string line;
+
+        formatEntry(ctx, line, value);
+        fputs(line.c_str(), f);
+    }
+
+    /* Appends the line of printEntry() to the string. */
+    void formatEntry(const AnalysisContext &ctx, std::string &out, double value) const
+    {
+        std::string pokemonName = normalizeName(ctx.getPokemon(pokemonId).name);
+        std::string fastName = normalizeName(removeFast(ctx.gameData.getMove(fastId).name));
+        std::string chargedName = normalizeName(ctx.gameData.getMove(chargedId).name);
+
+        appendFormat(out, "- %s: %s + %s : %g  (msDPS: %g) %s %s (Fast attacks per turn: %d, Number of chargeds used: %d)\n",
+            pokemonName.c_str(), fastName.c_str(), chargedName.c_str(), value, msDPS,
+            isLegacy ? "(*)" : "", dodging ? "" : "(cannot dodge)", fastAttacksPerTurn, nChargedUsed);
+    }
+
+    /* Prints the entry with two scores, used by the frontier reports. */
+    void printPair(const AnalysisContext &ctx, FILE *f, double value1, double value2) const
+    {
+        fprintf(f, "- %s: %s + %s : %g / %g  (msDPS: %g) %s\n",
+            normalizeName(ctx.getPokemon(pokemonId).name).c_str(),
+            normalizeName(removeFast(ctx.gameData.getMove(fastId).name)).c_str(),
+            normalizeName(ctx.gameData.getMove(chargedId).name).c_str(),
+            value1,
+            value2,
+            msDPS,
+            isLegacy ? "(*)" : ""
+        );
+    }
+};
+
+typedef Schema<PokemonInfo,
+    Field<(int)BaseStatsTag::STAMINA, VarIntMember<PokemonInfo, int, &PokemonInfo::baseStamina>>,
+    Field<(int)BaseStatsTag::ATTACK, VarIntMember<PokemonInfo, int, &PokemonInfo::baseAtk>>,
+    Field<(int)BaseStatsTag::DEFENSE, VarIntMember<PokemonInfo, int, &PokemonInfo::baseDef>>
+> BaseStatsSchema;
+
+typedef Schema<PokemonInfo,
+    Field<(int)PokemonDetailsTag::PRIMARY_TYPE, RepeatedVarIntMember<PokemonInfo, ArenaVector<int>, &PokemonInfo::pokemonTypes>>,
+    Field<(int)PokemonDetailsTag::SECONDARY_TYPE, RepeatedVarIntMember<PokemonInfo, ArenaVector<int>, &PokemonInfo::pokemonTypes>>,
+    Field<(int)PokemonDetailsTag::BASE_STATS, EmbeddedFields<PokemonInfo, BaseStatsSchema>>,
+    Field<(int)PokemonDetailsTag::QUICK_MOVES, PackedVarIntMember<PokemonInfo, ArenaVector<int>, &PokemonInfo::fastMoves>>,
+    Field<(int)PokemonDetailsTag::CHARGED_MOVES, PackedVarIntMember<PokemonInfo, ArenaVector<int>, &PokemonInfo::chargedMoves>>
+> PokemonDetailsSchema;
+
+/* Duration is stored in milliseconds. */
+DecodeStatus decodeMoveDuration(MoveInfo &mi, const Message &msg, DecodeError &)
+{
+    if (msg.type == WireType::VARINT) mi.duration = msg.data.varInt / 1000.0;
+
+    return DecodeStatus::OK;
+}
+
+typedef Schema<MoveInfo,
+    Field<(int)MoveDetailsTag::TYPE, VarIntMember<MoveInfo, int, &MoveInfo::moveType>>,
+    Field<(int)MoveDetailsTag::POWER, FloatMember<MoveInfo, &MoveInfo::power>>,
+    Field<(int)MoveDetailsTag::DURATION, CustomField<MoveInfo, decodeMoveDuration>>,
+    Field<(int)MoveDetailsTag::ENERGY, VarIntMember<MoveInfo, int, &MoveInfo::energy>>
+> MoveDetailsSchema;
+
+/* Contents of a type template. */
+struct TypeDetails
+{
+    int id;
+    ArenaVector<float> effectiveness; // Packed floats against each type in id order.
+
+    TypeDetails(Arena *arena) : id(-1), effectiveness(arena) {}
+};
+
+typedef Schema<TypeDetails,
+    Field<(int)TypeDetailsTag::TYPE_CHART, PackedFixedMember<TypeDetails, ArenaVector<float>, &TypeDetails::effectiveness>>,
+    Field<(int)TypeDetailsTag::ID, VarIntMember<TypeDetails, int, &TypeDetails::id>>
+> TypeDetailsSchema;
+
+/* Reads a pokémon template, the name matched V(id)_POKEMON_(name). */
+DecodeStatus loadPokemon(GameData &gd, const std::cmatch &match, const Message &details, DecodeError &error)
+{
+    int id = strtol(match[1].first, NULL, 10);
+    PokemonInfo pi;
+
+    pi.name = match[2].str();
+    pi.fastMoves = ArenaVector<int>(&gd.arena);
+    pi.chargedMoves = ArenaVector<int>(&gd.arena);
+    pi.pokemonTypes = ArenaVector<int>(&gd.arena);
+
+    if (PokemonDetailsSchema::tryDecode(pi, details, error) != DecodeStatus::OK) return error.status;
+
+    pi.nAvailableChargedMoves = pi.chargedMoves.size();
+    pi.nAvailableFastMoves = pi.fastMoves.size();
+
+    pi.id = id;
+    double CPBase = (pi.baseAtk + 15) * sqrt((pi.baseDef + 15) * (pi.baseStamina + 15));
+    pi.maxCP = CPBase * LEVEL40_CP_MULTIPLIER * LEVEL40_CP_MULTIPLIER / 10.0;
+    pi.prestigerCPMultiplier = 0; // Depends on the configuration, see setupAnalysis.
+    pi.tankiness = (pi.baseDef + 15) * (pi.baseStamina + 15);
+    pi.trueStrength = (pi.baseAtk + 15) * pi.tankiness / 10000.0;
+
+    gd.pokemonList[id] = std::move(pi);
+
+    gd.pokemonNameToId[gd.pokemonList[id].name] = id;
+
+    return DecodeStatus::OK;
+}
+
+/* Reads a move template, the name matched V(id)_MOVE_(name). */
+DecodeStatus loadMove(GameData &gd, const std::cmatch &match, const Message &details, DecodeError &error)
+{
+    int id = strtol(match[1].first, NULL, 10);
+    MoveInfo mi;
+
+    mi.name = match[2].str();
+
+    if (MoveDetailsSchema::tryDecode(mi, details, error) != DecodeStatus::OK) return error.status;
+
+    mi.id = id;
+    mi.eps = mi.energy / mi.duration;
+    mi.dps = mi.power / mi.duration;
+    mi.dpe = mi.power / mi.energy;
+
+    gd.moveList[id] = mi;
+
+    gd.moveNameToId[mi.name] = id;
+
+    return DecodeStatus::OK;
+}
+
+/* Reads a type template, the name matched POKEMON_TYPE_(name). */
+DecodeStatus loadType(GameData &gd, const std::cmatch &match, const Message &details, DecodeError &error)
+{
+    TypeDetails td(&gd.arena);
+
+    if (TypeDetailsSchema::tryDecode(td, details, error) != DecodeStatus::OK) return error.status;
+
+    gd.typeNames[td.id] = match[1].str();
+    gd.typeChart[td.id] = std::move(td.effectiveness);
+
+    return DecodeStatus::OK;
+}
+
+/* Kinds of the templates the analysis uses. */
+enum class TemplateKind
+{
+    OTHER,
+    POKEMON,
+    MOVE,
+    TYPE
+};
+
+/* Finds the name and the details of an ITEM_TEMPLATE record. Either is left UNKNOWN_TYPE when missing. */
+DecodeStatus splitItemTemplate(const Message &item, Message &name, Message &details, DecodeError &error)
+{
+    static const TagSet itemTemplateTags = {
+        (int)ItemTemplateTag::ITEM_NAME, (int)ItemTemplateTag::POKEMON_DETAILS, (int)ItemTemplateTag::MOVE_DETAILS, (int)ItemTemplateTag::POKEMON_TYPE_DETAILS};
+
+    if (item.type != WireType::LENGTH_PREFIXED) return DecodeStatus::OK;
+
+    for (const Message &field : FieldRange(item, itemTemplateTags, error))
+    {
+        switch ((ItemTemplateTag)field.tag)
+        {
+            case ItemTemplateTag::ITEM_NAME: name = field; break;
+            case ItemTemplateTag::POKEMON_DETAILS:
+            case ItemTemplateTag::MOVE_DETAILS:
+            case ItemTemplateTag::POKEMON_TYPE_DETAILS:
+                details = field; break;
+        }
+    }
+
+    return error.status;
+}
+
+/* Tells the kind of the template from its name. The match holds the id and the name as loadPokemon(), loadMove() and loadType() expect. */
+TemplateKind matchTemplateName(const Message &name, std::cmatch &match)
+{
+    static const std::regex pokemonPattern("^V(\\d+)_POKEMON_(.*)$");
+    static const std::regex movePattern("^V(\\d+)_MOVE_(.*)$");
+    static const std::regex typePattern("^POKEMON_TYPE_(.*)$");
+
+    // The template name is matched in place.
+    if (std::regex_search(name.begin(), name.end(), match, pokemonPattern)) return TemplateKind::POKEMON;
+    if (std::regex_search(name.begin(), name.end(), match, movePattern)) return TemplateKind::MOVE;
+    if (std::regex_search(name.begin(), name.end(), match, typePattern)) return TemplateKind::TYPE;
+
+    return TemplateKind::OTHER;
+}
+
+/* Reads an ITEM_TEMPLATE record of the game master. */
+DecodeStatus decodeItemTemplate(GameData &gd, const Message &item, DecodeError &error)
+{
+    Message name;
+    Message details;
+
+    if (splitItemTemplate(item, name, details, error) != DecodeStatus::OK) return error.status;
+    if ((name.type != WireType::LENGTH_PREFIXED) || (details.type != WireType::LENGTH_PREFIXED)) return DecodeStatus::OK;
+
+    std::cmatch match;
+
+    switch (matchTemplateName(name, match))
+    {
+        case TemplateKind::POKEMON: return loadPokemon(gd, match, details, error);
+        case TemplateKind::MOVE: return loadMove(gd, match, details, error);
+        case TemplateKind::TYPE: return loadType(gd, match, details, error);
+        case TemplateKind::OTHER: break;
+    }
+
+    return DecodeStatus::OK;
+}
+
+/* Parses the game master and fills the game data.
+    Malformed data doesn't throw, the error and its position are stored in error and the status is returned.
+ */
+DecodeStatus decodeGameData(GameData &gd, const uint8_t *buf, size_t n, DecodeError &error)
+{
+    static const TagSet rootTags = {(int)PogoProtoTag::ITEM_TEMPLATE};
+
+    for (const Message &item : FieldRange(buf, n, &rootTags, &error))
+    {
+        if (decodeItemTemplate(gd, item, error) != DecodeStatus::OK) return error.status;
+    }
+    if (error.status != DecodeStatus::OK) return error.status;
+
+    gd.effectiveness.build(gd.typeChart);
+
+    return DecodeStatus::OK;
+}
+
+/* Reader of decodeGameDataStream() for standard C files. */
+struct FileReader
+{
+    FILE *f;
+
+    FileReader(FILE *f) : f(f) {}
+
+    /* Reads up to n bytes, less only at the end of the stream. */
+    size_t read(uint8_t *buf, size_t n) {return fread(buf, 1, n, f);}
+};
+
+/* Parses a game master read from a stream that may not be seekable, like a pipe or an inflated zip entry.
+    Each top level record is decoded as soon as it has been read, only the incomplete record is kept in memory.
+    On errors errorOffset receives the stream offset of the malformed data.
+ */
+template <typename Reader>
+DecodeStatus decodeGameDataStream(GameData &gd, Reader &reader, size_t &errorOffset)
+{
+    const size_t CHUNK_SIZE = 64 * 1024;
+    std::vector<uint8_t> buffer; // Unparsed bytes read from the stream.
+    size_t streamPos = 0; // Stream offset of the start of the buffer.
+    size_t needed = CHUNK_SIZE; // Bytes to read for the incomplete record.
+    bool eof = false;
+    DecodeError error;
+
+    for (;;)
+    {
+        size_t old = buffer.size();
+
+        buffer.resize(old + needed);
+        size_t got = reader.read(&buffer[old], needed);
+        buffer.resize(old + got);
+        eof = got < needed;
+
+        // Decode the complete records.
+        size_t start = 0;
+
+        needed = CHUNK_SIZE;
+        while (start < buffer.size())
+        {
+            ProtoBuf pb(&buffer[start], buffer.size() - start);
+            Message msg;
+            DecodeStatus status = pb.tryGetMessage(msg);
+
+            if (status != DecodeStatus::OK)
+            {
+                if (eof)
+                {
+                    errorOffset = streamPos + (pb.getErrorPtr() - &buffer[0]);
+                    return status;
+                }
+
+                // The record is incomplete. When its length is known, read all of it at once.
+                ProtoBuf header(&buffer[start], buffer.size() - start);
+                uint64_t key;
+                uint64_t length;
+
+                if ((header.tryReadVarInt(key) == DecodeStatus::OK)
+                    && ((WireType)(key & 7) == WireType::LENGTH_PREFIXED)
+                    && (header.tryReadVarInt(length) == DecodeStatus::OK)
+                    && (length > header.getBytesLeft()))
+                {
+                    needed = std::max<uint64_t>(needed, length - header.getBytesLeft());
+                }
+                break;
+            }
+
+            if (((PogoProtoTag)msg.tag == PogoProtoTag::ITEM_TEMPLATE) && (decodeItemTemplate(gd, msg, error) != DecodeStatus::OK))
+            {
+                errorOffset = streamPos + (error.at - &buffer[0]);
+                return error.status;
+            }
+
+            start += pb.getBufPos();
+        }
+
+        // Keep the incomplete record.
+        buffer.erase(buffer.begin(), buffer.begin() + start);
+        streamPos += start;
+
+        if (eof) break;
+    }
+
+    gd.effectiveness.build(gd.typeChart);
+
+    return DecodeStatus::OK;
+}
+
+/* Same as decodeGameData(), throwing on errors. */
+void loadGameData(GameData &gd, const uint8_t *buf, size_t n)
+{
+    DecodeError error;
+
+    throwOnError(decodeGameData(gd, buf, n, error));
+}
+
+/* Game master decoded on demand.
+    buildIndex() makes one pass over the top level records and only reads the template names. It records the kind, the id and the offset of each pokémon, move and type template.
+    The details of a pokémon or a move are decoded on first access and cached, so a query about a few species doesn't pay for the whole file.
+    The types are decoded together when the type chart is first needed, there are only a few of them.
+    The buffer must outlive the object. The accessors fill the cache, so an instance must not be used from several threads at once.
+ */
+class LazyGameData
+{
+    struct TemplateRef
+    {
+        size_t offset; // Offset of the ITEM_TEMPLATE record.
+        std::string name;
+    };
+
+    const uint8_t *buf;
+    size_t n;
+    std::map<int, TemplateRef> pokemonRefs;
+    std::map<int, TemplateRef> moveRefs;
+    std::vector<size_t> typeOffsets;
+    std::map<std::string, int> pokemonNameToId;
+    std::map<std::string, int> moveNameToId;
+    bool typesLoaded;
+    GameData cache; // The templates decoded so far.
+
+    DecodeStatus decodeAt(size_t offset, DecodeError &error)
+    {
+        ProtoBuf pb(buf + offset, n - offset);
+        Message item;
+        DecodeStatus status = pb.tryGetMessage(item);
+
+        if (status != DecodeStatus::OK) return error.set(status, pb.getErrorPtr());
+
+        return decodeItemTemplate(cache, item, error);
+    }
+
+    static int findName(const std::map<std::string, int> &names, const std::string &name)
+    {
+        auto it = names.find(name);
+
+        return it == names.end() ? -1 : it->second;
+    }
+
+public:
+    LazyGameData(const uint8_t *buf, size_t n) : buf(buf), n(n), typesLoaded(false) {}
+
+    /* Scans the top level records. Errors in the details of the templates are only found when they are decoded. */
+    DecodeStatus buildIndex(DecodeError &error)
+    {
+        ProtoBuf pb(buf, n);
+
+        while (pb.getBytesLeft())
+        {
+            size_t offset = pb.getBufPos();
+            Message item;
+            Message name;
+            Message details;
+            DecodeStatus status = pb.tryGetMessage(item);
+
+            if (status != DecodeStatus::OK) return error.set(status, pb.getErrorPtr());
+            if ((PogoProtoTag)item.tag != PogoProtoTag::ITEM_TEMPLATE) continue;
+            if (splitItemTemplate(item, name, details, error) != DecodeStatus::OK) return error.status;
+            if ((name.type != WireType::LENGTH_PREFIXED) || (details.type != WireType::LENGTH_PREFIXED)) continue;
+
+            std::cmatch match;
+            TemplateKind kind = matchTemplateName(name, match);
+
+            if (kind == TemplateKind::TYPE) typeOffsets.push_back(offset);
+            if ((kind != TemplateKind::POKEMON) && (kind != TemplateKind::MOVE)) continue;
+
+            int id = strtol(match[1].first, NULL, 10);
+            TemplateRef ref = {offset, match[2].str()};
+
+            if (kind == TemplateKind::POKEMON)
+            {
+                pokemonNameToId[ref.name] = id;
+                pokemonRefs[id] = std::move(ref);
+            }
+            else
+            {
+                moveNameToId[ref.name] = id;
+                moveRefs[id] = std::move(ref);
+            }
+        }
+
+        return DecodeStatus::OK;
+    }
+
+    /* Id of the pokémon or move with the name, -1 for unknown names. */
+    int findPokemon(const std::string &name) const {return findName(pokemonNameToId, name);}
+    int findMove(const std::string &name) const {return findName(moveNameToId, name);}
+
+    /* Decodes the pokémon unless it's cached. pi is set to NULL for unknown ids. */
+    DecodeStatus tryGetPokemon(int id, const PokemonInfo *&pi, DecodeError &error)
+    {
+        pi = NULL;
+
+        auto ref = pokemonRefs.find(id);
+        if (ref == pokemonRefs.end()) return DecodeStatus::OK;
+
+        auto it = cache.pokemonList.find(id);
+        if (it == cache.pokemonList.end())
+        {
+            if (decodeAt(ref->second.offset, error) != DecodeStatus::OK) return error.status;
+            it = cache.pokemonList.find(id);
+        }
+        if (it != cache.pokemonList.end()) pi = &it->second;
+
+        return DecodeStatus::OK;
+    }
+
+    /* Same as tryGetPokemon() for moves. */
+    DecodeStatus tryGetMove(int id, const MoveInfo *&mi, DecodeError &error)
+    {
+        mi = NULL;
+
+        auto ref = moveRefs.find(id);
+        if (ref == moveRefs.end()) return DecodeStatus::OK;
+
+        auto it = cache.moveList.find(id);
+        if (it == cache.moveList.end())
+        {
+            if (decodeAt(ref->second.offset, error) != DecodeStatus::OK) return error.status;
+            it = cache.moveList.find(id);
+        }
+        if (it != cache.moveList.end()) mi = &it->second;
+
+        return DecodeStatus::OK;
+    }
+
+    /* Decodes the types and builds the type chart of the cache, once. */
+    DecodeStatus tryLoadTypes(DecodeError &error)
+    {
+        if (typesLoaded) return DecodeStatus::OK;
+
+        for (size_t offset : typeOffsets)
+        {
+            if (decodeAt(offset, error) != DecodeStatus::OK) return error.status;
+        }
+        cache.effectiveness.build(cache.typeChart);
+        typesLoaded = true;
+
+        return DecodeStatus::OK;
+    }
+
+    /* The templates decoded so far, the type chart is only complete after tryLoadTypes(). */
+    const GameData &getCache() const {return cache;}
+};
+
+/* Fields to replace in the details of a template, see -patch. */
+struct TemplatePatch
+{
+    std::map<int, Message> fields; // New values of the detail fields by tag.
+    std::map<int, Message> baseStats; // New values of the BASE_STATS fields of a pokémon.
+    bool applied;
+
+    TemplatePatch() : applied(false) {}
+};
+
+/* Patches of the pokémon and the moves by the name in their template. */
+struct GameMasterPatch
+{
+    std::map<std::string, TemplatePatch> pokemon;
+    std::map<std::string, TemplatePatch> moves;
+};
+
+/* Copies the fields of the message, replacing the ones with a new value.
+    Patched fields missing from the message are appended, so are the fields of a missing embedded message.
+    Fields of the embedded message with the tag are patched the same way.
+ */
+DecodeStatus encodePatchedFields(
+    ProtoEncoder &out,
+    const Message &msg,
+    const std::map<int, Message> &values,
+    DecodeError &error,
+    int embeddedTag = 0,
+    const std::map<int, Message> *embeddedValues = NULL
+)
+{
+    ProtoBuf pb(msg);
+    std::map<int, bool> written;
+    bool patchEmbedded = embeddedValues && !embeddedValues->empty();
+
+    while (pb.getBytesLeft())
+    {
+        size_t start = pb.getBufPos();
+        Message field;
+        DecodeStatus status = pb.tryGetMessage(field);
+
+        if (status != DecodeStatus::OK) return error.set(status, pb.getErrorPtr());
+
+        auto value = values.find(field.tag);
+
+        if (value != values.end())
+        {
+            // Repeated fields get the value once.
+            if (!written[field.tag]) out.writeField(value->second);
+        }
+        else if (patchEmbedded && (field.tag == embeddedTag) && (field.type == WireType::LENGTH_PREFIXED))
+        {
+            ProtoEncoder embedded;
+
+            if (encodePatchedFields(embedded, field, *embeddedValues, error) != DecodeStatus::OK) return error.status;
+            out.writeMessage(field.tag, embedded);
+        }
+        else
+        {
+            out.reference(msg.data.subMessage.buf + start, pb.getBufPos() - start);
+        }
+        written[field.tag] = true;
+    }
+
+    for (const auto &value : values)
+    {
+        if (!written[value.first]) out.writeField(value.second);
+    }
+    if (patchEmbedded && !written[embeddedTag])
+    {
+        ProtoEncoder embedded;
+
+        for (const auto &value : *embeddedValues) embedded.writeField(value.second);
+        out.writeMessage(embeddedTag, embedded);
+    }
+
+    return DecodeStatus::OK;
+}
+
+/* The patch of the template in the item, NULL if it's not patched. */
+TemplatePatch *findTemplatePatch(GameMasterPatch &patch, const Message &name)
+{
+    static const char pokemonInfix[] = "_POKEMON_";
+    static const char moveInfix[] = "_MOVE_";
+
+    // Most templates aren't patched, so the name after the infix is looked up before the slower regex match.
+    const char *pokemonName = std::search(name.begin(), name.end(), pokemonInfix, pokemonInfix + sizeof(pokemonInfix) - 1);
+    const char *moveName = std::search(name.begin(), name.end(), moveInfix, moveInfix + sizeof(moveInfix) - 1);
+    bool candidate =
+        ((pokemonName != name.end()) && patch.pokemon.count(std::string(pokemonName + sizeof(pokemonInfix) - 1, name.end())))
+        || ((moveName != name.end()) && patch.moves.count(std::string(moveName + sizeof(moveInfix) - 1, name.end())));
+
+    if (!candidate) return NULL;
+
+    std::cmatch match;
+    std::map<std::string, TemplatePatch> *patches;
+
+    switch (matchTemplateName(name, match))
+    {
+        case TemplateKind::POKEMON: patches = &patch.pokemon; break;
+        case TemplateKind::MOVE: patches = &patch.moves; break;
+        default: return NULL;
+    }
+
+    auto it = patches->find(match[2].str());
+
+    return it == patches->end() ? NULL : &it->second;
+}
+
+/* Re-emits the game master with the patch applied.
+    Only the patched templates are encoded again, everything else is referenced as it is, so the output costs about a copy of the input.
+ */
+DecodeStatus encodePatchedGameMaster(ProtoEncoder &out, const uint8_t *buf, size_t n, GameMasterPatch &patch, DecodeError &error)
+{
+    ProtoBuf pb(buf, n);
+
+    while (pb.getBytesLeft())
+    {
+        size_t start = pb.getBufPos();
+        Message item;
+        Message name;
+        Message details;
+        DecodeStatus status = pb.tryGetMessage(item);
+
+        if (status != DecodeStatus::OK) return error.set(status, pb.getErrorPtr());
+        if ((PogoProtoTag)item.tag == PogoProtoTag::ITEM_TEMPLATE)
+        {
+            if (splitItemTemplate(item, name, details, error) != DecodeStatus::OK) return error.status;
+        }
+
+        TemplatePatch *templatePatch = NULL;
+
+        if ((name.type == WireType::LENGTH_PREFIXED) && (details.type == WireType::LENGTH_PREFIXED)) templatePatch = findTemplatePatch(patch, name);
+        if (!templatePatch)
+        {
+            out.reference(buf + start, pb.getBufPos() - start);
+            continue;
+        }
+
+        // The item keeps its fields but the details, the details get the new values.
+        ProtoEncoder patchedItem;
+        ProtoBuf fields(item);
+
+        while (fields.getBytesLeft())
+        {
+            size_t fieldStart = fields.getBufPos();
+            Message field;
+
+            status = fields.tryGetMessage(field);
+            if (status != DecodeStatus::OK) return error.set(status, fields.getErrorPtr());
+            if ((field.type == WireType::LENGTH_PREFIXED) && (field.data.subMessage.buf == details.data.subMessage.buf))
+            {
+                ProtoEncoder patchedDetails;
+
+                if (encodePatchedFields(patchedDetails, field, templatePatch->fields, error, (int)PokemonDetailsTag::BASE_STATS, &templatePatch->baseStats) != DecodeStatus::OK)
+                {
+                    return error.status;
+                }
+                patchedItem.writeMessage(field.tag, patchedDetails);
+            }
+            else
+            {
+                patchedItem.reference(item.data.subMessage.buf + fieldStart, fields.getBufPos() - fieldStart);
+            }
+        }
+        out.writeMessage(item.tag, patchedItem);
+        templatePatch->applied = true;
+    }
+
+    return DecodeStatus::OK;
+}
+
+/* Reads the whitespace separated list of pokémon to leave out from the analysis. */
+void loadFilteredPokemon(AnalysisContext &ctx, std::istream &filters)
+{
+    std::string name;
+
+    while (filters >> name)
+    {
+        if (ctx.conf.verbose) printf("Filtering %s\n", name.c_str());
+        ctx.filtered[name] = true;
+    }
+}
+
+void addLegacyMove(
+    AnalysisContext &ctx,
+    const char *pokemonName,
+    const char *moveName
+)
+{
+    const GameData &gd = ctx.gameData;
+    auto pokemonIt = gd.pokemonNameToId.find(pokemonName);
+
+    if ((pokemonIt == gd.pokemonNameToId.end()) || (ctx.pokemonList.find(pokemonIt->second) == ctx.pokemonList.end()))
+    {
+        if (ctx.conf.verbose) printf("No such pokemon: %s\n", pokemonName);
+        return;
+    }
+    auto moveIt = gd.moveNameToId.find(moveName);
+    if (moveIt == gd.moveNameToId.end())
+    {
+        if (ctx.conf.verbose) printf("No such move: %s\n", moveName);
+        return;
+    }
+
+    const MoveInfo &moveInfo = gd.getMove(moveIt->second);
+    PokemonInfo &pi = ctx.pokemonList[pokemonIt->second];
+
+    if (moveInfo.energy <= 0)
+    {
+        pi.chargedMoves.push_back(moveIt->second);
+    }
+    else
+    {
+        pi.fastMoves.push_back(moveIt->second);
+    }
+}
+
+/* Reads the legacy moves (pokémon name and move name pairs). Returns nonzero on error. */
+int loadLegacyMoves(AnalysisContext &ctx, std::istream &ifs)
+{
+    for (;;)
+    {
+        std::string pokemon;
+
+        if (!(ifs >> pokemon)) break; // Break out when there is no entry.
+
+        std::string legacyMove;
+
+        if (!(ifs >> legacyMove))
+        {
+            if (ctx.conf.verbose) fprintf(stderr, "We have the pokemoin name but the legacy move is missing!\n");
+            return 1;
+        }
+
+        addLegacyMove(ctx, pokemon.c_str(), legacyMove.c_str());
+    }
+
+    return 0;
+}
+
+/* CP multiplier of the pokémon at the prestiger CP, 0 if it can't reach it. */
+double prestigerCPMultiplier(const PokemonInfo &pi, double prestigerCP)
+{
+    if (pi.maxCP < prestigerCP) return 0;
+
+    double CPBase = (pi.baseAtk + 15) * sqrt((pi.baseDef + 15) * (pi.baseStamina + 15));
+
+    return sqrt(prestigerCP * 10 / CPBase);
+}
+
+/* Builds the pokémon list of the analysis from the game data and the configuration.
+    The filter list must be loaded before calling this. Returns nonzero on error.
+ */
+int setupAnalysis(AnalysisContext &ctx)
+{
+    const Config &conf = ctx.conf;
+
+    for (const auto &kv : ctx.gameData.pokemonList)
+    {
+        if (ctx.filtered.find(kv.second.name) != ctx.filtered.end()) continue;
+
+        PokemonInfo &pi = ctx.pokemonList[kv.first];
+
+        pi = kv.second;
+        pi.prestigerCPMultiplier = prestigerCPMultiplier(pi, conf.prestigerCP);
+    }
+
+    // Set up legacy movesets.
+    if (conf.legacyMoves)
+    {
+        std::ifstream ifs(conf.legacyMoves);
+
+        if (loadLegacyMoves(ctx, ifs)) return 1;
+    }
+
+    return 0;
+}
+
+struct Option
+{
+    int nParameters;
+    std::string helpText;
+    int (*handler)(Config &conf, char **argv);
+};
+
+typedef int (*OptHandlerFunc)(const char *option);
+
+std::map<std::string, Option> options;
+
+void printHelp()
+{
+    printf("Pokémon GO protobuff analyzer. It takes the Pokémon GO protobuff file located on your phone, and output some analysis files into TXT files.\n\n");
+    printf("USAGE:\n\npogoproto filename [options]\n\n");
+    printf("Use - as the filename to read the game master from the standard input. Pipes are parsed while they are read.\n\n");
+    printf("OPTIONS:\n\n");
+
+    for (const auto &opt : options)
+    {
+        puts(opt.second.helpText.c_str());
+    }
+}
+
+struct DamageInfo
+{
+    double primaryDPS;
+    double secondaryDPS;
+    double time;
+    int expectedHitsPerTurn;
+    int chargedsUsed;
+};
+
+DamageInfo calculateDPS(const Config &conf, const PokemonInfo &pi, const MoveInfo &fastMove, const MoveInfo &chargedMove, double cpMultiplier, bool highlighted)
+{
+    double energy = 0;
+
+    DamageInfo dmg;
+
+    dmg.time = 0;
+    double primaryDamage = 0;
+    double secondaryDamage = 0;
+
+    double damage = 0;
+
+    dmg.expectedHitsPerTurn = floor((conf.roundLength - 0.49) / fastMove.duration);
+    bool dodging = dmg.expectedHitsPerTurn > 0;
+
+    double extraEnergy = 0.5*((pi.baseStamina + 15) * cpMultiplier);
+
+    if (highlighted)
+    {
+        printf("\n\n%s with moveset: %s + %s\n", pi.name.c_str(), fastMove.name.c_str(), chargedMove.name.c_str());
+        printf("extraEnergy: %g\n", extraEnergy);
+        printf("ExpectedHitsPerTurn: %d\n", dmg.expectedHitsPerTurn);
+    }
+
+    dmg.chargedsUsed = 0;
+
+    while (dmg.time < conf.battleTime)
+    {
+        const MoveInfo *moveToUse;
+        double *damageToRaise;
+        double stab = 1;
+        int nConsecutiveHits;
+        double remTime;
+
+        if (energy >= -chargedMove.energy)
+        {
+            // Do charged move.
+            moveToUse = &chargedMove;
+            damageToRaise = &secondaryDamage;
+            nConsecutiveHits = 1;
+            dmg.chargedsUsed++;
+        }
+        else
+        {
+            // Do fast move
+            moveToUse = &fastMove;
+            damageToRaise = &primaryDamage;
+            remTime = conf.roundLength - fmod(dmg.time, conf.roundLength);
+            if (dodging)
+            {
+                nConsecutiveHits = floor(remTime / fastMove.duration);
+                if (nConsecutiveHits > dmg.expectedHitsPerTurn) nConsecutiveHits = dmg.expectedHitsPerTurn;
+            }
+            else
+            {
+                nConsecutiveHits = 1;
+            }
+        }
+
+        for (int tid : pi.pokemonTypes)
+        {
+            if (moveToUse->moveType == tid)
+            {
+                stab = 1.25;
+                break;
+            }
+        }
+
+        damage += moveToUse->power * stab * nConsecutiveHits;
+        *damageToRaise += moveToUse->power * stab * nConsecutiveHits;
+        dmg.time += moveToUse->duration * nConsecutiveHits;
+        energy += moveToUse->energy * nConsecutiveHits;
+        energy += (moveToUse->duration / conf.lifeTime) * extraEnergy * nConsecutiveHits;
+        if (energy > 100) energy = 100;
+        if (highlighted)
+        {
+            printf("%s used %s %d times (damage: %g, energy: %d, staminaEnergy: %g)\n",
+                pi.name.c_str(),
+                moveToUse->name.c_str(),
+                nConsecutiveHits,
+                moveToUse->power,
+                moveToUse->energy,
+                (moveToUse->duration / conf.lifeTime) * extraEnergy
+            );
+            printf("t: %g, primary dmg: %g, secondary dmg: %g, energy: %g\n", dmg.time, primaryDamage, secondaryDamage, energy);
+        }
+        if (dodging && moveToUse == &fastMove)
+        {
+            remTime -= moveToUse->duration * nConsecutiveHits;
+            if (remTime < 0.5) remTime = 0.5;
+            dmg.time += remTime; // Time spent dodging.
+            if (highlighted)
+            {
+                printf("Then dodged for %g seconds.\n", remTime);
+                printf("t: %g, primary dmg: %g, secondary dmg: %g, energy: %g\n", dmg.time, primaryDamage, secondaryDamage, energy);
+            }
+        }
+        //fgetc(stdin);
+    }
+
+    dmg.primaryDPS = primaryDamage / dmg.time;
+    dmg.secondaryDPS = secondaryDamage / dmg.time;
+
+    return dmg;
+}
+
+/* Simulates a moveset and fills the moveset entry with the overall (neutral) damage. */
+MovesetDPS simulateMoveset(
+    const AnalysisContext &ctx,
+    const PokemonInfo &pi,
+    const MoveInfo &fastMove,
+    const MoveInfo &chargedMove,
+    bool legacy,
+    bool highlighted,
+    DamageInfo &dmg,
+    DamageInfo &dmgPrestiger
+)
+{
+    MovesetDPS mDPS;
+
+    // Simulate hitting a punching bag for conf.lifeTime seconds.
+    dmg = calculateDPS(ctx.conf, pi, fastMove, chargedMove, ATTACKER_CPM, highlighted);
+    dmgPrestiger = calculateDPS(ctx.conf, pi, fastMove, chargedMove, pi.prestigerCPMultiplier, highlighted);
+
+    // Get the overall DPS.
+    double rawDps = dmg.primaryDPS + dmg.secondaryDPS;
+    double prestigeDps = dmgPrestiger.primaryDPS + dmgPrestiger.secondaryDPS;
+
+    /* printf("Moveset DPS: %g\n", rawDps); */
+
+    mDPS.pokemonId = pi.id;
+    mDPS.fastId = fastMove.id;
+    mDPS.chargedId = chargedMove.id;
+    mDPS.isLegacy = legacy;
+    mDPS.dodging = dmg.expectedHitsPerTurn > 0;
+    mDPS.populate(rawDps, prestigeDps, pi);
+    mDPS.fastAttacksPerTurn = dmg.expectedHitsPerTurn;
+    mDPS.nChargedUsed = dmg.chargedsUsed;
+
+    return mDPS;
+}
+
+/* Moveset DPS against a defender of type t1 and t2.
+    Single typed pokémon are stored as double typed of the same type. Mind this.
+ */
+void counterDPS(
+    const GameData &gd,
+    const MoveInfo &fastMove,
+    const MoveInfo &chargedMove,
+    const DamageInfo &dmg,
+    const DamageInfo &dmgPrestiger,
+    int t1,
+    int t2,
+    double &theDPS,
+    double &thePrestigerDPS
+)
+{
+    double fastMultiplier = gd.effectiveness.getMultiplier(fastMove.moveType, t1, t2);
+    double chargedMultiplier = gd.effectiveness.getMultiplier(chargedMove.moveType, t1, t2);
+
+    theDPS = dmg.primaryDPS * fastMultiplier + dmg.secondaryDPS * chargedMultiplier;
+    thePrestigerDPS = dmgPrestiger.primaryDPS * fastMultiplier + dmgPrestiger.secondaryDPS * chargedMultiplier;
+}
+
+/* Narrows a value for the compact columns of the results store. */
+template <typename T>
+T narrowColumn(long long value)
+{
+    if ((value < 0) || ((unsigned long long)value > std::numeric_limits<T>::max()))
+    {
+        throw InvalidArgumentException("Value does not fit the results store.");
+    }
+
+    return (T)value;
+}
+
+/* Writes a column as raw bytes, see MovesetStore::save(). */
+template <typename T>
+bool writeColumn(FILE *f, const ArenaVector<T> &column)
+{
+    return fwrite(column.data(), sizeof(T), column.size(), f) == column.size();
+}
+
+/* Reads n values of a column written by writeColumn(). */
+template <typename T>
+bool readColumn(FILE *f, ArenaVector<T> &column, size_t n)
+{
+    column.resize(n);
+
+    return fread(column.data(), sizeof(T), n, f) == n;
+}
+
+/* Every simulated moveset is stored once, column by column. Report buckets refer to the rows by index. */
+struct MovesetStore
+{
+    enum
+    {
+        LEGACY = 1,
+        DODGING = 2
+    };
+
+    ArenaVector<uint16_t> pokemonIds;
+    ArenaVector<uint16_t> fastIds;
+    ArenaVector<uint16_t> chargedIds;
+    ArenaVector<uint8_t> flags;
+    ArenaVector<uint16_t> fastAttacksPerTurn;
+    ArenaVector<uint32_t> nChargedUsed;
+    ArenaVector<double> primaryDPS; // DPS of the fast move
+    ArenaVector<double> secondaryDPS; // DPS of the charged move
+    ArenaVector<double> prestigerPrimaryDPS; // Same at the prestiger CP
+    ArenaVector<double> prestigerSecondaryDPS;
+
+    MovesetStore(Arena *arena) :
+        pokemonIds(arena),
+        fastIds(arena),
+        chargedIds(arena),
+        flags(arena),
+        fastAttacksPerTurn(arena),
+        nChargedUsed(arena),
+        primaryDPS(arena),
+        secondaryDPS(arena),
+        prestigerPrimaryDPS(arena),
+        prestigerSecondaryDPS(arena)
+    {
+    }
+
+    size_t size() const {return pokemonIds.size();}
+
+    void reserve(size_t n)
+    {
+        pokemonIds.reserve(n);
+        fastIds.reserve(n);
+        chargedIds.reserve(n);
+        flags.reserve(n);
+        fastAttacksPerTurn.reserve(n);
+        nChargedUsed.reserve(n);
+        primaryDPS.reserve(n);
+        secondaryDPS.reserve(n);
+        prestigerPrimaryDPS.reserve(n);
+        prestigerSecondaryDPS.reserve(n);
+    }
+
+    /* Writes the columns in the native byte order, the file is only read back by the same build. */
+    bool save(FILE *f) const
+    {
+        return writeColumn(f, pokemonIds) && writeColumn(f, fastIds) && writeColumn(f, chargedIds) && writeColumn(f, flags) &&
+            writeColumn(f, fastAttacksPerTurn) && writeColumn(f, nChargedUsed) && writeColumn(f, primaryDPS) && writeColumn(f, secondaryDPS) &&
+            writeColumn(f, prestigerPrimaryDPS) && writeColumn(f, prestigerSecondaryDPS);
+    }
+
+    /* Size of a row written by save(). */
+    static size_t rowBytes() {return 4 * sizeof(uint16_t) + sizeof(uint8_t) + sizeof(uint32_t) + 4 * sizeof(double);}
+
+    /* Reads n rows written by save(). */
+    bool load(FILE *f, size_t n)
+    {
+        return readColumn(f, pokemonIds, n) && readColumn(f, fastIds, n) && readColumn(f, chargedIds, n) && readColumn(f, flags, n) &&
+            readColumn(f, fastAttacksPerTurn, n) && readColumn(f, nChargedUsed, n) && readColumn(f, primaryDPS, n) && readColumn(f, secondaryDPS, n) &&
+            readColumn(f, prestigerPrimaryDPS, n) && readColumn(f, prestigerSecondaryDPS, n);
+    }
+
+    /* Overall moveset DPS. */
+    double getRawDPS(uint32_t row) const {return primaryDPS[row] + secondaryDPS[row];}
+    double getPrestigerDPS(uint32_t row) const {return prestigerPrimaryDPS[row] + prestigerSecondaryDPS[row];}
+
+    /* Damage of the row in the form calculateDPS returned it. */
+    void getDamage(uint32_t row, DamageInfo &dmg, DamageInfo &dmgPrestiger) const
+    {
+        dmg.primaryDPS = primaryDPS[row];
+        dmg.secondaryDPS = secondaryDPS[row];
+        dmgPrestiger.primaryDPS = prestigerPrimaryDPS[row];
+        dmgPrestiger.secondaryDPS = prestigerSecondaryDPS[row];
+    }
+
+    /* Adds the moveset and returns its row. */
+    uint32_t add(const MovesetDPS &mDPS, const DamageInfo &dmg, const DamageInfo &dmgPrestiger)
+    {
+        uint32_t row = narrowColumn<uint32_t>(size());
+
+        pokemonIds.push_back(narrowColumn<uint16_t>(mDPS.pokemonId));
+        fastIds.push_back(narrowColumn<uint16_t>(mDPS.fastId));
+        chargedIds.push_back(narrowColumn<uint16_t>(mDPS.chargedId));
+        flags.push_back((mDPS.isLegacy ? LEGACY : 0) | (mDPS.dodging ? DODGING : 0));
+        fastAttacksPerTurn.push_back(narrowColumn<uint16_t>(mDPS.fastAttacksPerTurn));
+        nChargedUsed.push_back(narrowColumn<uint32_t>(mDPS.nChargedUsed));
+        primaryDPS.push_back(dmg.primaryDPS);
+        secondaryDPS.push_back(dmg.secondaryDPS);
+        prestigerPrimaryDPS.push_back(dmgPrestiger.primaryDPS);
+        prestigerSecondaryDPS.push_back(dmgPrestiger.secondaryDPS);
+
+        return row;
+    }
+};
+
+/* Movesets of a report bucket with their DPS against the target of the bucket. */
+struct MovesetBucket
+{
+    ArenaVector<uint32_t> rows;
+    ArenaVector<double> rawDPS;
+    ArenaVector<double> prestigerDPS;
+
+    MovesetBucket(Arena *arena = NULL) : rows(arena), rawDPS(arena), prestigerDPS(arena) {}
+
+    size_t size() const {return rows.size();}
+
+    void reserve(size_t n)
+    {
+        rows.reserve(n);
+        rawDPS.reserve(n);
+        prestigerDPS.reserve(n);
+    }
+
+    void add(uint32_t row, double raw, double prestige)
+    {
+        rows.push_back(row);
+        rawDPS.push_back(raw);
+        prestigerDPS.push_back(prestige);
+    }
+};
+
+typedef std::pair<double, uint32_t> ScoredIndex; // Sort key and the position of the item it belongs to.
+
+bool higherScore(const ScoredIndex &a, const ScoredIndex &b) {return a.first > b.first;}
+
+/* Sorts the items by the key in descending order.
+    Only (key, index) pairs are moved around, the items are just pointed to.
+ */
+template <typename T, typename KeyFunc>
+void sortByScore(std::vector<const T *> &items, KeyFunc key)
+{
+    std::vector<ScoredIndex> order(items.size());
+    std::vector<const T *> sorted(items.size());
+
+    for (size_t i = 0; i < items.size(); i++)
+    {
+        order[i] = std::make_pair(key(*items[i]), (uint32_t)i);
+    }
+
+    std::sort(order.begin(), order.end(), higherScore);
+
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        sorted[i] = items[order[i].second];
+    }
+    items.swap(sorted);
+}
+
+enum class ScoreKey
+{
+    DPS,
+    TRUE_POWER,
+    PRESTIGE_POWER
+};
+
+/* Set of results store rows, a bit per row. */
+class RowBitmap
+{
+    std::vector<uint64_t> words;
+    size_t nBits;
+
+public:
+    RowBitmap(size_t n = 0, bool value = false) : words((n + 63) / 64, value ? ~0ULL : 0), nBits(n)
+    {
+        clearTail();
+    }
+
+    size_t size() const {return nBits;}
+
+    bool test(uint32_t row) const {return (words[row / 64] >> (row % 64)) & 1;}
+    void set(uint32_t row) {words[row / 64] |= 1ULL << (row % 64);}
+
+    /* Sets the rows in [first, end). */
+    void setRange(uint32_t first, uint32_t end)
+    {
+        for (; (first < end) && (first % 64); first++) set(first);
+        for (; first + 64 <= end; first += 64) words[first / 64] = ~0ULL;
+        for (; first < end; first++) set(first);
+    }
+
+    void clearRange(uint32_t first, uint32_t end)
+    {
+        for (; first < end; first++) words[first / 64] &= ~(1ULL << (first % 64));
+    }
+
+    RowBitmap &operator&=(const RowBitmap &other)
+    {
+        for (size_t w = 0; w < words.size(); w++) words[w] &= other.words[w];
+
+        return *this;
+    }
+
+    RowBitmap &operator|=(const RowBitmap &other)
+    {
+        for (size_t w = 0; w < words.size(); w++) words[w] |= other.words[w];
+
+        return *this;
+    }
+
+    /* Keeps the rows not in the other bitmap. */
+    RowBitmap &subtract(const RowBitmap &other)
+    {
+        for (size_t w = 0; w < words.size(); w++) words[w] &= ~other.words[w];
+
+        return *this;
+    }
+
+    size_t count() const
+    {
+        size_t n = 0;
+
+        for (uint64_t word : words) n += popcount64(word);
+
+        return n;
+    }
+
+private:
+    void clearTail()
+    {
+        if (nBits % 64) words.back() &= (1ULL << (nBits % 64)) - 1;
+    }
+};
+
+/* Bitmaps of the results store rows for each attribute value, for filtering queries before ranking. */
+struct MovesetIndex
+{
+    RowBitmap legacy;
+    RowBitmap dodging;
+    std::map<int, RowBitmap> byMoveType; // Movesets with a fast or charged move of the type.
+    std::map<int, RowBitmap> byPokemonType; // Movesets of pokémon of the type.
+    std::vector<std::pair<double, int>> pokemonByMaxCP; // Max CP and id of the pokémon, ascending.
+};
+
+/* Conditions on the movesets of a query, all of them must hold. */
+struct MovesetFilter
+{
+    int legacy; // 0 for non legacy, 1 for legacy movesets only, -1 for both.
+    int dodging; // Same for dodging.
+    std::vector<int> moveTypes; // One of the moves has one of these types. Empty for any.
+    std::vector<int> pokemonTypes; // The pokémon has one of these types. Empty for any.
+    double minMaxCP; // Only pokémon with at least this max CP.
+    std::vector<int> excludedPokemon; // Pokémon ids to leave out.
+
+    MovesetFilter() : legacy(-1), dodging(-1), minMaxCP(0) {}
+};
+
+/* Simulated movesets of an analysis put into the buckets of the reports.
+    The columns are allocated from the arena of the results, so they are released together.
+ */
+struct AnalysisResults
+{
+    Arena arena; // Must be the first member.
+    MovesetStore movesets;
+    std::vector<const PokemonInfo *> pokemonById; // Pokémon of the analysis indexed by id.
+    std::map<int, std::pair<uint32_t, uint32_t>> pokemonRows; // First and past the end row of each pokémon's movesets.
+    std::map<int, MovesetBucket> movesetStatsByType; // Moveset stats for each type
+    std::map<int, std::map<int, MovesetBucket>> bestCounters; // Moveset stats for each type combination (FIXME: the key should be a int, int tuple instead of this)
+    MovesetIndex index; // Built by buildMovesetIndex() for filtered queries.
+
+    AnalysisResults() : arena(1024 * 1024), movesets(&arena) {}
+
+    /* Type bucket, created with room for n entries on first use. */
+    MovesetBucket &getTypeBucket(int type, size_t n)
+    {
+        auto it = movesetStatsByType.find(type);
+
+        if (it == movesetStatsByType.end())
+        {
+            it = movesetStatsByType.insert(std::make_pair(type, MovesetBucket(&arena))).first;
+            it->second.reserve(n);
+        }
+
+        return it->second;
+    }
+
+    /* Type pair bucket, created with room for n entries on first use. */
+    MovesetBucket &getCounterBucket(int t1, int t2, size_t n)
+    {
+        auto &buckets = bestCounters[t1];
+        auto it = buckets.find(t2);
+
+        if (it == buckets.end())
+        {
+            it = buckets.insert(std::make_pair(t2, MovesetBucket(&arena))).first;
+            it->second.reserve(n);
+        }
+
+        return it->second;
+    }
+
+    /* Bucket of the rows in [first, end) with their overall DPS. */
+    MovesetBucket rowRange(uint32_t first, uint32_t end) const
+    {
+        MovesetBucket bucket;
+
+        bucket.reserve(end - first);
+        for (uint32_t row = first; row < end; row++)
+        {
+            bucket.add(row, movesets.getRawDPS(row), movesets.getPrestigerDPS(row));
+        }
+
+        return bucket;
+    }
+
+    /* Materializes the i-th entry of the bucket. */
+    MovesetDPS getEntry(const MovesetBucket &bucket, size_t i) const
+    {
+        MovesetDPS mDPS;
+        uint32_t row = bucket.rows[i];
+
+        mDPS.pokemonId = movesets.pokemonIds[row];
+        mDPS.fastId = movesets.fastIds[row];
+        mDPS.chargedId = movesets.chargedIds[row];
+        mDPS.isLegacy = movesets.flags[row] & MovesetStore::LEGACY;
+        mDPS.dodging = movesets.flags[row] & MovesetStore::DODGING;
+        mDPS.fastAttacksPerTurn = movesets.fastAttacksPerTurn[row];
+        mDPS.nChargedUsed = movesets.nChargedUsed[row];
+        mDPS.populate(bucket.rawDPS[i], bucket.prestigerDPS[i], *pokemonById[mDPS.pokemonId]);
+
+        return mDPS;
+    }
+
+    /* Same value as the corresponding field of getEntry(). */
+    double getScore(const MovesetBucket &bucket, size_t i, ScoreKey key) const
+    {
+        uint32_t row = bucket.rows[i];
+        const PokemonInfo &pi = *pokemonById[movesets.pokemonIds[row]];
+
+        switch (key)
+        {
+            case ScoreKey::DPS: return MovesetDPS::dpsScore(bucket.rawDPS[i], pi);
+            case ScoreKey::TRUE_POWER: return MovesetDPS::truePowerScore(bucket.rawDPS[i], pi, movesets.flags[row] & MovesetStore::DODGING);
+            case ScoreKey::PRESTIGE_POWER: return MovesetDPS::prestigePowerScore(bucket.prestigerDPS[i], pi);
+        }
+
+        return 0;
+    }
+
+    /* Scores of the bucket paired with the positions in the bucket. */
+    std::vector<ScoredIndex> scoreBucket(const MovesetBucket &bucket, ScoreKey key) const
+    {
+        std::vector<ScoredIndex> order(bucket.size());
+
+        for (size_t i = 0; i < bucket.size(); i++)
+        {
+            order[i] = std::make_pair(getScore(bucket, i, key), (uint32_t)i);
+        }
+
+        return order;
+    }
+
+    /* Positions of the best k entries of the bucket, best first. */
+    std::vector<uint32_t> topPositions(const MovesetBucket &bucket, ScoreKey key, size_t k) const
+    {
+        std::vector<ScoredIndex> order = scoreBucket(bucket, key);
+        std::vector<uint32_t> result;
+
+        k = std::min(k, order.size());
+        std::partial_sort(order.begin(), order.begin() + k, order.end(), higherScore);
+        for (size_t i = 0; i < k; i++)
+        {
+            result.push_back(order[i].second);
+        }
+
+        return result;
+    }
+
+    /* Positions of the best k entries of the bucket whose row is in the set, best first. */
+    std::vector<uint32_t> topPositions(const MovesetBucket &bucket, ScoreKey key, size_t k, const RowBitmap &selected) const
+    {
+        std::vector<ScoredIndex> order;
+        std::vector<uint32_t> result;
+
+        for (size_t i = 0; i < bucket.size(); i++)
+        {
+            if (selected.test(bucket.rows[i])) order.push_back(std::make_pair(getScore(bucket, i, key), (uint32_t)i));
+        }
+
+        k = std::min(k, order.size());
+        std::partial_sort(order.begin(), order.begin() + k, order.end(), higherScore);
+        for (size_t i = 0; i < k; i++)
+        {
+            result.push_back(order[i].second);
+        }
+
+        return result;
+    }
+
+    /* Rows passing the filter, evaluated over the index bitmaps. */
+    RowBitmap selectRows(const MovesetFilter &filter) const
+    {
+        size_t n = movesets.size();
+        RowBitmap selected(n, true);
+
+        if (filter.legacy == 1) selected &= index.legacy;
+        if (filter.legacy == 0) selected.subtract(index.legacy);
+        if (filter.dodging == 1) selected &= index.dodging;
+        if (filter.dodging == 0) selected.subtract(index.dodging);
+
+        // Values of the same attribute are or'ed together.
+        auto selectAny = [n, &selected](const std::map<int, RowBitmap> &bitmaps, const std::vector<int> &values)
+        {
+            if (values.empty()) return;
+
+            RowBitmap any(n);
+
+            for (int value : values)
+            {
+                auto it = bitmaps.find(value);
+                if (it != bitmaps.end()) any |= it->second;
+            }
+            selected &= any;
+        };
+
+        selectAny(index.byMoveType, filter.moveTypes);
+        selectAny(index.byPokemonType, filter.pokemonTypes);
+
+        // Pokémon rows are contiguous, so the per pokémon conditions are ranges.
+        if (filter.minMaxCP > 0)
+        {
+            RowBitmap strong(n);
+            auto first = std::lower_bound(index.pokemonByMaxCP.begin(), index.pokemonByMaxCP.end(), std::make_pair(filter.minMaxCP, std::numeric_limits<int>::min()));
+
+            for (auto it = first; it != index.pokemonByMaxCP.end(); ++it)
+            {
+                auto rows = pokemonRows.find(it->second);
+                if (rows != pokemonRows.end()) strong.setRange(rows->second.first, rows->second.second);
+            }
+            selected &= strong;
+        }
+
+        for (int id : filter.excludedPokemon)
+        {
+            auto rows = pokemonRows.find(id);
+            if (rows != pokemonRows.end()) selected.clearRange(rows->second.first, rows->second.second);
+        }
+
+        return selected;
+    }
+
+    /* Sorts the bucket by the score in descending order. */
+    void sortBucket(MovesetBucket &bucket, ScoreKey key) const
+    {
+        std::vector<ScoredIndex> order = scoreBucket(bucket, key);
+
+        std::sort(order.begin(), order.end(), higherScore);
+
+        // Permute the columns in place, the arena would not reclaim a replaced bucket.
+        permuteColumn(bucket.rows, order);
+        permuteColumn(bucket.rawDPS, order);
+        permuteColumn(bucket.prestigerDPS, order);
+    }
+
+    template <typename T>
+    static void permuteColumn(ArenaVector<T> &column, const std::vector<ScoredIndex> &order)
+    {
+        std::vector<T> permuted(column.size());
+
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            permuted[i] = column[order[i].second];
+        }
+        std::copy(permuted.begin(), permuted.end(), column.begin());
+    }
+
+    /* Appends the lines of printBucket() to the string. */
+    void formatBucket(const AnalysisContext &ctx, std::string &out, const MovesetBucket &bucket, ScoreKey key) const
+    {
+        for (size_t i = 0; i < bucket.size(); i++)
+        {
+            MovesetDPS mdps = getEntry(bucket, i);
+
+            switch (key)
+            {
+                case ScoreKey::DPS: mdps.formatEntry(ctx, out, mdps.DPS); break;
+                case ScoreKey::TRUE_POWER: mdps.formatEntry(ctx, out, mdps.truePower); break;
+                case ScoreKey::PRESTIGE_POWER: mdps.formatEntry(ctx, out, mdps.prestigePower); break;
+            }
+        }
+    }
+
+    /* Prints the entries of the bucket with the given score. */
+    void printBucket(const AnalysisContext &ctx, FILE *f, const MovesetBucket &bucket, ScoreKey key) const
+    {
+        for (size_t i = 0; i < bucket.size(); i++)
+        {
+            MovesetDPS mdps = getEntry(bucket, i);
+
+            switch (key)
+            {
+                case ScoreKey::DPS: mdps.printEntry(ctx, f, mdps.DPS); break;
+                case ScoreKey::TRUE_POWER: mdps.printEntry(ctx, f, mdps.truePower); break;
+                case ScoreKey::PRESTIGE_POWER: mdps.printEntry(ctx, f, mdps.prestigePower); break;
+            }
+        }
+    }
+};
+
+/* Simulates every moveset of every pokémon in the analysis. */
+void simulateMovesets(const AnalysisContext &ctx, AnalysisResults &results)
+{
+    const GameData &gd = ctx.gameData;
+    const Config &conf = ctx.conf;
+    size_t maxRows = 0;
+
+    for (const auto &kv : ctx.pokemonList)
+    {
+        maxRows += kv.second.fastMoves.size() * kv.second.chargedMoves.size();
+    }
+    results.movesets.reserve(maxRows);
+
+    if (!ctx.pokemonList.empty())
+    {
+        results.pokemonById.resize(ctx.pokemonList.rbegin()->first + 1);
+    }
+
+    // For each pokémon...
+    for (const auto &kv : ctx.pokemonList)
+    {
+        const PokemonInfo &pi = kv.second;
+
+        results.pokemonById[kv.first] = &pi;
+        uint32_t firstRow = results.movesets.size();
+
+        bool highlighted = (conf.highlightPokemonName) && (pi.name == conf.highlightPokemonName);
+
+        // For each moveset combination...
+        for (size_t i = 0; i < pi.fastMoves.size(); i++)
+        {
+            int fmi = pi.fastMoves[i];
+            for (size_t j = 0; j < pi.chargedMoves.size(); j++)
+            {
+                int cmi = pi.chargedMoves[j];
+                const MoveInfo &fastMove = gd.getMove(fmi);
+                const MoveInfo &chargedMove = gd.getMove(cmi);
+                bool legacy = (i >= pi.nAvailableFastMoves) || (j >= pi.nAvailableChargedMoves);
+
+                DamageInfo dmg;
+                DamageInfo dmgPrestiger;
+                MovesetDPS mDPS = simulateMoveset(ctx, pi, fastMove, chargedMove, legacy, highlighted, dmg, dmgPrestiger);
+
+                if (!mDPS.dodging) continue;
+
+                results.movesets.add(mDPS, dmg, dmgPrestiger);
+            }
+        }
+
+        results.pokemonRows[kv.first] = std::make_pair(firstRow, (uint32_t)results.movesets.size());
+    }
+}
+
+/* Marks the movesets that another moveset of the same pokémon beats against every defender.
+    Against any type pair a moveset deals primaryDPS * (effectiveness of the fast move type) + secondaryDPS * (effectiveness of the charged move type),
+    so a moveset with the same move types and no lower DPS values (at the prestiger CP too) ranks at least as high in every counter list.
+    A legacy moveset never prunes a regular one. Of equal movesets the first one is kept.
+ */
+std::vector<bool> findDominatedMovesets(const AnalysisContext &ctx, const AnalysisResults &results)
+{
+    const GameData &gd = ctx.gameData;
+    const MovesetStore &movesets = results.movesets;
+    std::vector<bool> dominated(movesets.size());
+
+    for (const auto &kv : results.pokemonRows)
+    {
+        uint32_t first = kv.second.first;
+        uint32_t end = kv.second.second;
+        std::vector<std::pair<int, int>> types; // Fast and charged move type of each row.
+
+        for (uint32_t row = first; row < end; row++)
+        {
+            types.push_back(std::make_pair(gd.getMove(movesets.fastIds[row]).moveType, gd.getMove(movesets.chargedIds[row]).moveType));
+        }
+
+        for (uint32_t a = first; a < end; a++)
+        {
+            for (uint32_t b = first; b < end; b++)
+            {
+                if ((a == b) || dominated[b]) continue;
+                if (types[a - first] != types[b - first]) continue;
+                if ((movesets.flags[b] & MovesetStore::LEGACY) && !(movesets.flags[a] & MovesetStore::LEGACY)) continue;
+
+                // Does b dominate a?
+                if ((movesets.primaryDPS[b] < movesets.primaryDPS[a])
+                    || (movesets.secondaryDPS[b] < movesets.secondaryDPS[a])
+                    || (movesets.prestigerPrimaryDPS[b] < movesets.prestigerPrimaryDPS[a])
+                    || (movesets.prestigerSecondaryDPS[b] < movesets.prestigerSecondaryDPS[a])) continue;
+
+                bool equal =
+                    (movesets.primaryDPS[b] == movesets.primaryDPS[a])
+                    && (movesets.secondaryDPS[b] == movesets.secondaryDPS[a])
+                    && (movesets.prestigerPrimaryDPS[b] == movesets.prestigerPrimaryDPS[a])
+                    && (movesets.prestigerSecondaryDPS[b] == movesets.prestigerSecondaryDPS[a])
+                    && ((movesets.flags[b] & MovesetStore::LEGACY) == (movesets.flags[a] & MovesetStore::LEGACY));
+
+                if (equal && (b > a)) continue;
+
+                dominated[a] = true;
+                break;
+            }
+        }
+    }
+
+    return dominated;
+}
+
+/* Puts the simulated movesets into the type and type pair buckets.
+    The sizes of the buckets are known from the rows, so each is allocated once.
+ */
+void fillBuckets(const AnalysisContext &ctx, AnalysisResults &results)
+{
+    const GameData &gd = ctx.gameData;
+    const MovesetStore &movesets = results.movesets;
+    std::map<int, size_t> typeCounts;
+    std::vector<bool> dominated;
+    size_t nCounters = movesets.size(); // Number of movesets in each counter list.
+
+    if (ctx.conf.pruneDominated)
+    {
+        dominated = findDominatedMovesets(ctx, results);
+        size_t nDominated = std::count(dominated.begin(), dominated.end(), true);
+
+        nCounters -= nDominated;
+        if (ctx.conf.verbose) printf("Leaving %zu dominated movesets out of the counter lists.\n", nDominated);
+    }
+
+    for (uint32_t row = 0; row < movesets.size(); row++)
+    {
+        int fastType = gd.getMove(movesets.fastIds[row]).moveType;
+        int chargedType = gd.getMove(movesets.chargedIds[row]).moveType;
+
+        typeCounts[fastType]++;
+        if (chargedType != fastType) typeCounts[chargedType]++;
+    }
+
+    const EffectivenessCodes &effectiveness = gd.effectiveness;
+    std::vector<MovesetBucket *> counterBuckets; // Bucket of each defender type pair.
+
+    if (movesets.size())
+    {
+        for (const auto &pair : effectiveness.pairTypes) counterBuckets.push_back(&results.getCounterBucket(pair.first, pair.second, nCounters));
+    }
+
+    for (uint32_t row = 0; row < movesets.size(); row++)
+    {
+        const MoveInfo &fastMove = gd.getMove(movesets.fastIds[row]);
+        const MoveInfo &chargedMove = gd.getMove(movesets.chargedIds[row]);
+        DamageInfo dmg;
+        DamageInfo dmgPrestiger;
+
+        movesets.getDamage(row, dmg, dmgPrestiger);
+
+        // TODO: Hidden power of all type.
+        // Put them into the typed buckets to find out
+        if (chargedMove.moveType == fastMove.moveType)
+        {
+            // Same type of damage
+            results.getTypeBucket(fastMove.moveType, typeCounts[fastMove.moveType]).add(row, movesets.getRawDPS(row), movesets.getPrestigerDPS(row));
+        }
+        else
+        {
+            // Fast and charged are different.
+            results.getTypeBucket(fastMove.moveType, typeCounts[fastMove.moveType]).add(row, dmg.primaryDPS, dmgPrestiger.primaryDPS);
+            results.getTypeBucket(chargedMove.moveType, typeCounts[chargedMove.moveType]).add(row, dmg.secondaryDPS, dmgPrestiger.secondaryDPS);
+        }
+
+        if (!dominated.empty() && dominated[row]) continue;
+
+        // For each type combination find out how much damage the moveset does, same as counterDPS.
+        const uint8_t *fastCodes = effectiveness.getRow(fastMove.moveType);
+        const uint8_t *chargedCodes = effectiveness.getRow(chargedMove.moveType);
+        const double *multipliers = &effectiveness.multipliers[0];
+
+        for (size_t pair = 0; pair < effectiveness.nPairs; pair++)
+        {
+            double fastMultiplier = multipliers[fastCodes[pair]];
+            double chargedMultiplier = multipliers[chargedCodes[pair]];
+
+            counterBuckets[pair]->add(
+                row,
+                dmg.primaryDPS * fastMultiplier + dmg.secondaryDPS * chargedMultiplier,
+                dmgPrestiger.primaryDPS * fastMultiplier + dmgPrestiger.secondaryDPS * chargedMultiplier);
+        }
+    }
+}
+
+/* Builds the bitmaps of the filtered queries over the simulated movesets. */
+void buildMovesetIndex(const AnalysisContext &ctx, AnalysisResults &results)
+{
+    const GameData &gd = ctx.gameData;
+    const MovesetStore &movesets = results.movesets;
+    MovesetIndex &index = results.index;
+    size_t n = movesets.size();
+
+    index.legacy = RowBitmap(n);
+    index.dodging = RowBitmap(n);
+    for (const auto &t : gd.typeNames)
+    {
+        index.byMoveType[t.first] = RowBitmap(n);
+        index.byPokemonType[t.first] = RowBitmap(n);
+    }
+
+    // Types missing from the type chart still get a bitmap of their own.
+    auto bitmapOf = [n](std::map<int, RowBitmap> &bitmaps, int type) -> RowBitmap &
+    {
+        auto it = bitmaps.find(type);
+        if (it == bitmaps.end()) it = bitmaps.insert(std::make_pair(type, RowBitmap(n))).first;
+
+        return it->second;
+    };
+
+    for (uint32_t row = 0; row < n; row++)
+    {
+        if (movesets.flags[row] & MovesetStore::LEGACY) index.legacy.set(row);
+        if (movesets.flags[row] & MovesetStore::DODGING) index.dodging.set(row);
+        bitmapOf(index.byMoveType, gd.getMove(movesets.fastIds[row]).moveType).set(row);
+        bitmapOf(index.byMoveType, gd.getMove(movesets.chargedIds[row]).moveType).set(row);
+    }
+
+    for (const auto &rows : results.pokemonRows)
+    {
+        const PokemonInfo &pi = ctx.getPokemon(rows.first);
+
+        for (int type : pi.pokemonTypes) bitmapOf(index.byPokemonType, type).setRange(rows.second.first, rows.second.second);
+        index.pokemonByMaxCP.push_back(std::make_pair(pi.maxCP, rows.first));
+    }
+    std::sort(index.pokemonByMaxCP.begin(), index.pokemonByMaxCP.end());
+}
+
+void computeResults(const AnalysisContext &ctx, AnalysisResults &results)
+{
+    simulateMovesets(ctx, results);
+    fillBuckets(ctx, results);
+    buildMovesetIndex(ctx, results);
+}
+
+/* Splits the string at the separator. */
+std::vector<std::string> splitString(const std::string &str, char separator)
+{
+    std::vector<std::string> parts;
+    std::stringstream ss(str);
+    std::string part;
+
+    while (std::getline(ss, part, separator)) parts.push_back(part);
+
+    return parts;
+}
+
+/* Looks up a type id by name, -1 if not found. */
+int findType(const GameData &gd, const std::string &name)
+{
+    for (const auto &kv : gd.typeNames)
+    {
+        if (kv.second == name) return kv.first;
+    }
+
+    return -1;
+}
+
+/* Counter query of the -query option. */
+struct CounterQuery
+{
+    MovesetFilter filter;
+    int type1;
+    int type2;
+    size_t k; // Number of counters to print.
+    ScoreKey key;
+
+    CounterQuery() : type1(-1), type2(-1), k(10), key(ScoreKey::DPS) {}
+};
+
+/* Parses the terms of -query, before the simulation so a bad query fails fast. Nonzero if the query is invalid. */
+int parseQuery(const GameData &gd, const char *terms, CounterQuery &query)
+{
+    MovesetFilter &filter = query.filter;
+    int &type1 = query.type1;
+    int &type2 = query.type2;
+
+    for (const std::string &term : splitString(terms, ','))
+    {
+        size_t eq = term.find('=');
+        std::string name = term.substr(0, eq);
+        std::string value = eq == std::string::npos ? "" : term.substr(eq + 1);
+        std::vector<std::string> values = splitString(value, '|');
+
+        if (name == "vs")
+        {
+            std::vector<std::string> types = splitString(value, '-');
+
+            if (types.empty() || (types.size() > 2)) return 1;
+            type1 = findType(gd, types.front());
+            type2 = findType(gd, types.back());
+            if ((type1 < 0) || (type2 < 0)) return 1;
+            if (type1 > type2) std::swap(type1, type2);
+        }
+        else if (name == "top")
+        {
+            char *end;
+            long k = strtol(value.c_str(), &end, 10);
+
+            if (value.empty() || *end || (k <= 0)) return 1;
+            query.k = k;
+        }
+        else if (name == "sort")
+        {
+            if (value == "dps") query.key = ScoreKey::DPS;
+            else if (value == "truepower") query.key = ScoreKey::TRUE_POWER;
+            else if (value == "prestige") query.key = ScoreKey::PRESTIGE_POWER;
+            else return 1;
+        }
+        else if ((name == "legacy") || (name == "dodging"))
+        {
+            int &flag = name == "legacy" ? filter.legacy : filter.dodging;
+
+            if (value == "yes") flag = 1;
+            else if (value == "no") flag = 0;
+            else return 1;
+        }
+        else if ((name == "movetype") || (name == "type"))
+        {
+            std::vector<int> &types = name == "movetype" ? filter.moveTypes : filter.pokemonTypes;
+
+            for (const std::string &v : values)
+            {
+                int type = findType(gd, v);
+
+                if (type < 0) return 1;
+                types.push_back(type);
+            }
+        }
+        else if (name == "mincp")
+        {
+            char *end;
+
+            filter.minMaxCP = strtod(value.c_str(), &end);
+            if (value.empty() || *end) return 1;
+        }
+        else if (name == "exclude")
+        {
+            for (const std::string &v : values)
+            {
+                auto it = gd.pokemonNameToId.find(v);
+
+                if (it == gd.pokemonNameToId.end()) return 1;
+                filter.excludedPokemon.push_back(it->second);
+            }
+        }
+        else
+        {
+            return 1;
+        }
+    }
+
+    return type1 < 0 ? 1 : 0;
+}
+
+/* Runs the parsed counter query and prints the result. */
+void runQuery(const AnalysisContext &ctx, const AnalysisResults &results, const CounterQuery &query)
+{
+    const GameData &gd = ctx.gameData;
+    int type1 = query.type1;
+    int type2 = query.type2;
+    size_t k = query.k;
+    ScoreKey key = query.key;
+
+    // Without any simulated moveset there are no buckets.
+    const MovesetBucket empty;
+    const MovesetBucket *bucket = &empty;
+    auto counters = results.bestCounters.find(type1);
+
+    if (counters != results.bestCounters.end())
+    {
+        auto it = counters->second.find(type2);
+
+        if (it != counters->second.end()) bucket = &it->second;
+    }
+
+    RowBitmap selected = results.selectRows(query.filter);
+
+    printf("Best %zu counters against %s-%s, %zu of %zu movesets match the filter:\n\n", k, gd.getTypeName(type1), gd.getTypeName(type2), selected.count(), selected.size());
+    for (uint32_t pos : results.topPositions(*bucket, key, k, selected))
+    {
+        results.getEntry(*bucket, pos).printEntry(ctx, stdout, results.getScore(*bucket, pos, key));
+    }
+    printf("\n");
+}
+
+/* Writes the pokémon lists ordered by CP, tankiness and true strength. */
+void writePokemonRankings(const AnalysisContext &ctx)
+{
+    std::vector<const PokemonInfo *> pis; // The pokémon in the order of the listing.
+
+    for (const auto &pi : ctx.pokemonList)
+    {
+        pis.push_back(&pi.second);
+    }
+
+    sortByScore(pis, [](const PokemonInfo &pi) {return pi.maxCP; });
+
+    {
+        AutoFile cpFile = createReport("cplist.txt");
+        fprintf(cpFile, "Highest CP\n\n");
+
+        for (const PokemonInfo *pi : pis)
+        {
+            fprintf(cpFile, "%s: %g\n", pi->name.c_str(), pi->maxCP);
+        }
+    }
+
+    sortByScore(pis, [](const PokemonInfo &pi) {return pi.tankiness; });
+
+    {
+        AutoFile tankinessFile = createReport("tankiness.txt");
+        fprintf(tankinessFile, "Highest effective HP (Defense * Stamina)\n\n");
+
+        for (const PokemonInfo *pi : pis)
+        {
+            fprintf(tankinessFile, "%s:  %g\n", pi->name.c_str(), pi->tankiness);
+        }
+    }
+
+    sortByScore(pis, [](const PokemonInfo &pi) {return pi.trueStrength; });
+
+    {
+        AutoFile trueStrengthFile = createReport("truestrength.txt");
+        fprintf(trueStrengthFile, "Best Defense*Attackl*Stamina\n\n");
+
+        for (const PokemonInfo *pi : pis)
+        {
+            fprintf(trueStrengthFile, "%s:  %g\n", pi->name.c_str(), pi->trueStrength);
+        }
+    }
+}
+
+/* Writes the move list ordered by name. */
+void writeMoveList(const AnalysisContext &ctx)
+{
+    const GameData &gd = ctx.gameData;
+    AutoFile moves = createReport(MOVE_LIST_FILE);
+
+    fprintf(moves, "%-5s%-30s %-30s %-10s %-10s %-10s %-10s %-10s %-10s\n",
+        "Id",
+        "Name",
+        "Type",
+        "Power",
+        "Energy",
+        "Duration",
+        "EPS",
+        "DPS",
+        "DPE"
+    );
+
+    std::vector<const MoveInfo *> moveByName; // To store the list of moves alphabetically.
+    for (const auto &mip : gd.moveList)
+    {
+        moveByName.push_back(&mip.second);
+    }
+    std::sort(moveByName.begin(), moveByName.end(), [](const MoveInfo *a, const MoveInfo *b){return a->name < b->name;});
+
+    for (const MoveInfo *mi : moveByName)
+    {
+        fprintf(moves, "%-5d%-30s %-30s %-10g %-10d %-10g %-10g %-10g %-10g\n",
+            mi->id,
+            mi->name.c_str(),
+            gd.getTypeName(mi->moveType),
+            mi->power,
+            mi->energy,
+            mi->duration,
+            mi->eps,
+            mi->dps,
+            mi->dpe
+        );
+    }
+}
+
+/* Writes each pokémon and their respective moveset. */
+void writePokemonList(const AnalysisContext &ctx, AnalysisResults &results)
+{
+    const GameData &gd = ctx.gameData;
+    AutoFile pokemons = createReport(POKEMON_LIST_FILE);
+
+    for (const auto &kv : ctx.pokemonList)
+    {
+        const PokemonInfo &pi = kv.second;
+
+        std::stringstream str;
+        for (auto tid : pi.pokemonTypes)
+        {
+            str << gd.getTypeName(tid) << " ";
+        }
+
+        fprintf(pokemons, "#%d %s (Type: %s) (Max CP: %g, ATK: %d, DEF: %d, STA: %d), prestiger CP multiplier: %g\n",
+            pi.id,
+            pi.name.c_str(),
+            str.str().c_str(),
+            pi.maxCP,
+            pi.baseAtk,
+            pi.baseDef,
+            pi.baseStamina,
+            pi.prestigerCPMultiplier
+        );
+        fprintf(pokemons, "Fast moves: \n");
+
+        const auto &rows = results.pokemonRows[kv.first];
+        MovesetBucket pokemonMovesets = results.rowRange(rows.first, rows.second);
+
+        results.sortBucket(pokemonMovesets, ScoreKey::DPS);
+        results.printBucket(ctx, pokemons, pokemonMovesets, ScoreKey::DPS);
+        fprintf(pokemons, "\n");
+    }
+}
+
+/* Blocking queue of at most capacity items between two pipeline stages.
+    A full queue stalls the producer, so a fast stage can not run ahead of a slow one with unbounded memory.
+ */
+template <typename T>
+class BoundedQueue
+{
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    std::deque<T> items;
+    size_t capacity;
+    bool closed;
+
+public:
+    BoundedQueue(size_t capacity) : capacity(capacity), closed(false) {}
+
+    /* Adds the item, false if the queue was closed meanwhile and the item dropped. */
+    bool push(T &&item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        notFull.wait(lock, [this] {return (items.size() < this->capacity) || closed; });
+        if (closed) return false;
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+
+        return true;
+    }
+
+    /* Takes the next item, false once the queue is closed and empty. */
+    bool pop(T &item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        notEmpty.wait(lock, [this] {return !items.empty() || closed; });
+        if (items.empty()) return false;
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+
+        return true;
+    }
+
+    /* Wakes the consumer up when the producer is done, or a blocked producer when the consumer gives up. */
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        closed = true;
+        notEmpty.notify_all();
+        notFull.notify_all();
+    }
+};
+
+#ifdef POGOPROTO_URING
+/* Submission and completion rings of io_uring on the raw system calls, without liburing. Only writes are supported. */
+class IoUring
+{
+    int fd;
+    io_uring_params params;
+    void *sqRing;
+    size_t sqRingSize;
+    void *cqRing;
+    size_t cqRingSize;
+    io_uring_sqe *sqes;
+    unsigned *sqTail;
+    unsigned *sqMask;
+    unsigned *sqArray;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned *cqMask;
+    io_uring_cqe *cqes;
+
+    IoUring(const IoUring &) = delete;
+    IoUring &operator=(const IoUring &) = delete;
+
+    int enter(unsigned toSubmit, unsigned minComplete, unsigned flags)
+    {
+        return syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0);
+    }
+
+public:
+    /* Check isOpen(), io_uring may be missing or disabled. */
+    IoUring(unsigned entries) : sqRing(MAP_FAILED), cqRing(MAP_FAILED), sqes((io_uring_sqe *)MAP_FAILED)
+    {
+        memset(&params, 0, sizeof(params));
+        fd = syscall(__NR_io_uring_setup, entries, &params);
+        if (fd < 0) return;
+
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+
+        sqRing = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) cqRing = sqRing;
+        else cqRing = mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        sqes = (io_uring_sqe *)mmap(NULL, params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if ((sqRing == MAP_FAILED) || (cqRing == MAP_FAILED) || (sqes == MAP_FAILED))
+        {
+            close(fd);
+            fd = -1;
+            return;
+        }
+
+        uint8_t *sq = (uint8_t *)sqRing;
+        uint8_t *cq = (uint8_t *)cqRing;
+
+        sqTail = (unsigned *)(sq + params.sq_off.tail);
+        sqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+        sqArray = (unsigned *)(sq + params.sq_off.array);
+        cqHead = (unsigned *)(cq + params.cq_off.head);
+        cqTail = (unsigned *)(cq + params.cq_off.tail);
+        cqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+        cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+    }
+
+    ~IoUring()
+    {
+        if (sqes != MAP_FAILED) munmap(sqes, params.sq_entries * sizeof(io_uring_sqe));
+        if ((cqRing != MAP_FAILED) && (cqRing != sqRing)) munmap(cqRing, cqRingSize);
+        if (sqRing != MAP_FAILED) munmap(sqRing, sqRingSize);
+        if (fd >= 0) close(fd);
+    }
+
+    bool isOpen() const {return fd >= 0;}
+
+    /* Registers the buffers for writeFixed(). Fails eg. over the locked memory limit. */
+    bool registerBuffers(const iovec *buffers, unsigned n)
+    {
+        return !syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, buffers, n);
+    }
+
+    /* Submits a write of the registered buffer, or of the iovec with bufferIndex -1.
+        At most as many writes as the ring has entries can be in flight.
+     */
+    bool submitWrite(int fileFd, const iovec *buffer, int bufferIndex, uint64_t offset, uint64_t userData)
+    {
+        unsigned tail = *sqTail;
+        unsigned index = tail & *sqMask;
+        io_uring_sqe &sqe = sqes[index];
+
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.fd = fileFd;
+        sqe.off = offset;
+        sqe.user_data = userData;
+        if (bufferIndex >= 0)
+        {
+            sqe.opcode = IORING_OP_WRITE_FIXED;
+            sqe.addr = (uint64_t)(uintptr_t)buffer->iov_base;
+            sqe.len = buffer->iov_len;
+            sqe.buf_index = bufferIndex;
+        }
+        else
+        {
+            sqe.opcode = IORING_OP_WRITEV;
+            sqe.addr = (uint64_t)(uintptr_t)buffer;
+            sqe.len = 1;
+        }
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+
+        return enter(1, 0, 0) == 1;
+    }
+
+    /* Waits for the next completed write, result is the number of bytes written or -errno. */
+    bool waitCompletion(uint64_t &userData, int &result)
+    {
+        unsigned head = *cqHead;
+
+        while (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+        {
+            if ((enter(0, 1, IORING_ENTER_GETEVENTS) < 0) && (errno != EINTR)) return false;
+        }
+
+        const io_uring_cqe &cqe = cqes[head & *cqMask];
+
+        userData = cqe.user_data;
+        result = cqe.res;
+        __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+
+        return true;
+    }
+};
+#endif
+
+#ifdef POGOPROTO_ZLIB
+/* Worker threads compressing the blocks of the gzip report streams. */
+class CompressorPool
+{
+    BoundedQueue<std::packaged_task<void()>> jobs;
+    std::vector<std::thread> workers;
+    int level;
+
+public:
+    CompressorPool(int level) : jobs(64), level(level)
+    {
+        unsigned n = std::max(1u, std::thread::hardware_concurrency());
+
+        for (unsigned i = 0; i < n; i++)
+        {
+            workers.emplace_back([this]()
+            {
+                std::packaged_task<void()> job;
+
+                while (jobs.pop(job)) job();
+            });
+        }
+    }
+
+    ~CompressorPool()
+    {
+        jobs.close();
+        for (std::thread &worker : workers) worker.join();
+    }
+
+    size_t getSize() const {return workers.size();}
+    int getLevel() const {return level;}
+
+    void run(std::packaged_task<void()> &&job) {jobs.push(std::move(job));}
+};
+
+/* gzip stream made of independently deflated blocks, so they can be compressed in parallel as pigz does.
+    Each block is primed with the last 32 KB of the one before and ends with a sync flush, so the pieces concatenate into one deflate stream.
+    The CRC of the blocks is combined in order.
+ */
+class GzipStream
+{
+    static const size_t GZIP_BLOCK_SIZE = 1024 * 1024;
+    static const size_t WINDOW_SIZE = 32 * 1024;
+
+    struct CompressedBlock
+    {
+        std::string data;
+        uLong crc;
+        size_t inputSize;
+        bool failed;
+    };
+
+    CompressorPool &pool;
+    std::function<void(const char *, size_t)> sink;
+    std::string block;
+    std::string dictionary;
+    std::deque<std::future<CompressedBlock>> pending;
+    uLong crc;
+    uint32_t inputSize; // Modulo 2^32 as in the trailer.
+    bool failed;
+
+    static CompressedBlock deflateBlock(const std::string &input, const std::string &dictionary, int level, bool last)
+    {
+        CompressedBlock result;
+        z_stream zs;
+
+        memset(&zs, 0, sizeof(zs));
+        result.crc = crc32(crc32(0, Z_NULL, 0), (const Bytef *)input.data(), input.size());
+        result.inputSize = input.size();
+        result.failed = deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK;
+        if (result.failed) return result;
+
+        if (!dictionary.empty()) deflateSetDictionary(&zs, (const Bytef *)dictionary.data(), dictionary.size());
+        result.data.resize(deflateBound(&zs, input.size()) + 16);
+        zs.next_in = (Bytef *)input.data();
+        zs.avail_in = input.size();
+
+        int status;
+
+        do
+        {
+            if (zs.total_out == result.data.size()) result.data.resize(2 * result.data.size());
+            zs.next_out = (Bytef *)&result.data[zs.total_out];
+            zs.avail_out = result.data.size() - zs.total_out;
+            status = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+        }
+        while ((status == Z_OK) && (last || zs.avail_in || !zs.avail_out));
+
+        result.failed = last ? status != Z_STREAM_END : status != Z_OK;
+        result.data.resize(zs.total_out);
+        deflateEnd(&zs);
+
+        return result;
+    }
+
+    /* Hands the block to the pool and writes out the finished ones, waiting for the oldest while too many are pending. */
+    void submit(bool last)
+    {
+        std::packaged_task<CompressedBlock()> task(std::bind(deflateBlock, std::move(block), dictionary, pool.getLevel(), last));
+
+        pending.push_back(task.get_future());
+        pool.run(std::packaged_task<void()>(std::move(task)));
+
+        size_t keep = last ? 0 : 2 * pool.getSize();
+
+        while (pending.size() > keep) writePending();
+
+        block.clear();
+        block.reserve(GZIP_BLOCK_SIZE);
+    }
+
+    void writePending()
+    {
+        CompressedBlock compressed = pending.front().get();
+
+        pending.pop_front();
+        failed = failed || compressed.failed;
+        crc = crc32_combine(crc, compressed.crc, compressed.inputSize);
+        inputSize += compressed.inputSize;
+        sink(compressed.data.data(), compressed.data.size());
+    }
+
+    static void putUInt32(uint8_t *p, uint32_t value)
+    {
+        for (int i = 0; i < 4; i++) p[i] = value >> (8 * i);
+    }
+
+public:
+    GzipStream(CompressorPool &pool, std::function<void(const char *, size_t)> sink) : pool(pool), sink(sink), crc(crc32(0, Z_NULL, 0)), inputSize(0), failed(false)
+    {
+        static const uint8_t header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 255};
+
+        sink((const char *)header, sizeof(header));
+        block.reserve(GZIP_BLOCK_SIZE);
+    }
+
+    void write(const char *data, size_t n)
+    {
+        while (n)
+        {
+            size_t part = std::min(n, GZIP_BLOCK_SIZE - block.size());
+
+            block.append(data, part);
+            data += part;
+            n -= part;
+            if (block.size() == GZIP_BLOCK_SIZE)
+            {
+                std::string window(block, GZIP_BLOCK_SIZE - WINDOW_SIZE, WINDOW_SIZE);
+
+                submit(false);
+                dictionary = std::move(window);
+            }
+        }
+    }
+
+    /* Compresses the rest and writes the trailer. False if deflate failed. */
+    bool finish()
+    {
+        uint8_t trailer[8];
+
+        submit(true);
+        putUInt32(trailer, crc);
+        putUInt32(trailer + 4, inputSize);
+        sink((const char *)trailer, sizeof(trailer));
+
+        return !failed;
+    }
+};
+#endif
+
+/* Report file written in big blocks, see -output.
+    With io_uring up to N_BLOCKS blocks are written asynchronously from registered buffers while the next one is filled,
+    bypassing the page cache with O_DIRECT where the file system allows. Then the last block is padded and the file truncated.
+    Without io_uring the uring method falls back to pwrite, and without pwrite (Windows) everything goes through stdio.
+    With a compressor pool (-gzip) the file is a gzip stream of the written text.
+ */
+class ReportFile
+{
+    static const size_t WRITE_BLOCK_SIZE = 1024 * 1024;
+    static const size_t N_BLOCKS = 4;
+    static const size_t DIRECT_ALIGNMENT = 4096;
+
+    std::string name;
+    OutputMethod method;
+    FILE *f;
+    int fd;
+    bool direct;
+    bool failed;
+    std::vector<uint8_t *> blocks;
+    size_t current; // Block being filled.
+    size_t used; // Bytes in the current block.
+    uint64_t size; // Bytes written before the current block.
+#ifdef POGOPROTO_URING
+    std::unique_ptr<IoUring> ring;
+    std::vector<iovec> buffers; // Registered buffers of the blocks, iov_len is the length in flight.
+    std::vector<uint64_t> offsets; // File offsets in flight.
+    std::vector<bool> busy;
+    bool registered;
+#endif
+#ifdef POGOPROTO_ZLIB
+    std::unique_ptr<GzipStream> gzip;
+#endif
+
+    ReportFile(const ReportFile &) = delete;
+    ReportFile &operator=(const ReportFile &) = delete;
+
+#ifndef _WIN32
+    bool writeAt(const uint8_t *data, size_t n, uint64_t offset)
+    {
+        while (n)
+        {
+            ssize_t written = pwrite(fd, data, n, offset);
+
+            if ((written < 0) && (errno == EINTR)) continue;
+#ifdef POGOPROTO_URING
+            if ((written < 0) && (errno == EINVAL) && direct)
+            {
+                // The file system took the O_DIRECT open but not the write.
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+                direct = false;
+                continue;
+            }
+#endif
+            if (written <= 0) return false;
+            data += written;
+            n -= written;
+            offset += written;
+        }
+
+        return true;
+    }
+#endif
+
+#ifdef POGOPROTO_URING
+    /* Waits for one write, finishing short or failed ones with pwrite. */
+    void complete()
+    {
+        uint64_t block;
+        int result;
+
+        if (!ring->waitCompletion(block, result))
+        {
+            failed = true;
+            std::fill(busy.begin(), busy.end(), false);
+            return;
+        }
+
+        size_t done = result > 0 ? result : 0;
+        const iovec &buffer = buffers[block];
+
+        if ((done < buffer.iov_len) && !writeAt((const uint8_t *)buffer.iov_base + done, buffer.iov_len - done, offsets[block] + done)) failed = true;
+        busy[block] = false;
+    }
+#endif
+
+    /* Writes n bytes of the current block and moves on to the next one. */
+    void flushBlock(size_t n)
+    {
+#ifdef POGOPROTO_URING
+        if (method == OutputMethod::URING)
+        {
+            buffers[current].iov_len = n;
+            offsets[current] = size;
+            busy[current] = true;
+            if (!ring->submitWrite(fd, &buffers[current], registered ? (int)current : -1, size, current))
+            {
+                busy[current] = false;
+                if (!writeAt(blocks[current], n, size)) failed = true;
+            }
+            size += n;
+            used = 0;
+            current = (current + 1) % blocks.size();
+            while (busy[current]) complete();
+            return;
+        }
+#endif
+#ifndef _WIN32
+        if (!writeAt(blocks[current], n, size)) failed = true;
+#endif
+        size += n;
+        used = 0;
+    }
+
+public:
+    /* Creates the file like createReport(), throws FileNotFoundException if it can not. */
+    ReportFile(const char *fileName, OutputMethod outputMethod) : name(fileName), method(outputMethod), f(NULL), fd(-1), direct(false), failed(false), current(0), used(0), size(0)
+    {
+#ifdef _WIN32
+        method = OutputMethod::STDIO;
+#endif
+#ifdef POGOPROTO_URING
+        registered = false;
+        if (method == OutputMethod::URING)
+        {
+            ring.reset(new IoUring(N_BLOCKS));
+            if (!ring->isOpen()) method = OutputMethod::PWRITE;
+        }
+#else
+        if (method == OutputMethod::URING) method = OutputMethod::PWRITE;
+#endif
+
+        if (method == OutputMethod::STDIO)
+        {
+            f = createReport(fileName);
+            if (!f) throw FileNotFoundException();
+            return;
+        }
+
+#ifndef _WIN32
+        remove(fileName);
+#ifdef POGOPROTO_URING
+        if (method == OutputMethod::URING)
+        {
+            fd = open(fileName, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0666);
+            direct = fd >= 0;
+        }
+#endif
+        if (fd < 0) fd = open(fileName, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd < 0) throw FileNotFoundException();
+
+        blocks.resize(method == OutputMethod::URING ? N_BLOCKS : 1);
+        for (uint8_t *&block : blocks)
+        {
+            void *p = NULL;
+
+            if (posix_memalign(&p, DIRECT_ALIGNMENT, WRITE_BLOCK_SIZE))
+            {
+                for (uint8_t *allocated : blocks) free(allocated);
+                ::close(fd);
+                throw std::bad_alloc();
+            }
+            block = (uint8_t *)p;
+        }
+#endif
+#ifdef POGOPROTO_URING
+        if (method == OutputMethod::URING)
+        {
+            for (uint8_t *block : blocks)
+            {
+                iovec buffer = {block, WRITE_BLOCK_SIZE};
+
+                buffers.push_back(buffer);
+            }
+            offsets.resize(blocks.size());
+            busy.resize(blocks.size());
+            registered = ring->registerBuffers(buffers.data(), buffers.size());
+        }
+#endif
+    }
+
+    ~ReportFile()
+    {
+        close();
+        for (uint8_t *block : blocks) free(block);
+    }
+
+    /* Writes the bytes to the file as they are. */
+    void writeRaw(const char *data, size_t n)
+    {
+        if (f)
+        {
+            fwrite(data, 1, n, f);
+            return;
+        }
+
+        while (n)
+        {
+            size_t part = std::min(n, WRITE_BLOCK_SIZE - used);
+
+            memcpy(blocks[current] + used, data, part);
+            used += part;
+            data += part;
+            n -= part;
+            if (used == WRITE_BLOCK_SIZE) flushBlock(WRITE_BLOCK_SIZE);
+        }
+    }
+
+#ifdef POGOPROTO_ZLIB
+    /* Compresses everything written from now on with gzip. */
+    void compress(CompressorPool &pool)
+    {
+        gzip.reset(new GzipStream(pool, [this](const char *data, size_t n) {writeRaw(data, n); }));
+    }
+#endif
+
+    void write(const char *data, size_t n)
+    {
+#ifdef POGOPROTO_ZLIB
+        if (gzip)
+        {
+            gzip->write(data, n);
+            return;
+        }
+#endif
+        writeRaw(data, n);
+    }
+
+    void write(const char *text) {write(text, strlen(text));}
+
+    /* Writes what is left and closes the file. False if any write failed. */
+    bool close()
+    {
+#ifdef POGOPROTO_ZLIB
+        if (gzip)
+        {
+            if (!gzip->finish()) failed = true;
+            gzip.reset();
+        }
+#endif
+        if (f)
+        {
+            bool ok = !ferror(f);
+
+            if (fclose(f)) ok = false;
+            f = NULL;
+            return ok && !failed;
+        }
+        if (fd < 0) return !failed;
+
+#ifndef _WIN32
+        uint64_t fileSize = size + used;
+
+        if (used)
+        {
+            size_t n = used;
+
+            if (direct)
+            {
+                n = (used + DIRECT_ALIGNMENT - 1) / DIRECT_ALIGNMENT * DIRECT_ALIGNMENT;
+                memset(blocks[current] + used, 0, n - used);
+            }
+            flushBlock(n);
+        }
+#ifdef POGOPROTO_URING
+        if (method == OutputMethod::URING)
+        {
+            while (std::find(busy.begin(), busy.end(), true) != busy.end()) complete();
+        }
+#endif
+        if ((size != fileSize) && ftruncate(fd, fileSize)) failed = true;
+        if (::close(fd)) failed = true;
+        fd = -1;
+#endif
+
+        return !failed;
+    }
+
+    const std::string &getName() const {return name;}
+};
+
+/* Type pair bucket sorted by one score, passed from the ranking to the formatting stage. */
+struct RankedBucket
+{
+    int t1;
+    int t2;
+    size_t report; // Index into COUNTER_REPORTS.
+    MovesetBucket bucket; // Sorted heap copy, the arena of the results is not thread safe.
+    MovesetBucket *target; // Bucket of the results, replaced with the last ranking.
+};
+
+/* Formatted text of a report, passed from the formatting to the writing stage. */
+struct ReportChunk
+{
+    size_t report;
+    std::string text;
+};
+
+struct CounterReport
+{
+    const char *fileName;
+    const char *title;
+    ScoreKey key;
+};
+
+// In the order the buckets are sorted, each ranking starts from the previous one.
+const CounterReport COUNTER_REPORTS[] = {
+    {"DPSCounters.txt", "Best DPS against particular types.\n\n", ScoreKey::DPS},
+    {"DTFCounters.txt", "Best DTF against particular types.\n\n", ScoreKey::TRUE_POWER},
+    {"prestigers.txt", "Best prestigers against particular types.\n\n", ScoreKey::PRESTIGE_POWER}
+};
+
+const size_t N_COUNTER_REPORTS = sizeof(COUNTER_REPORTS) / sizeof(COUNTER_REPORTS[0]);
+
+/* File name of the report, compressed with -gzip. */
+std::string counterReportFileName(const CounterReport &report, const Config &conf)
+{
+    return std::string(report.fileName) + (conf.gzipLevel ? ".gz" : "");
+}
+
+/* Writes the counter lists of every type pair, ranked by each score of COUNTER_REPORTS.
+    They make up most of the output, so they run as a pipeline: a thread ranks the buckets of the type pairs,
+    another one formats the ranked buckets while the calling thread writes the text of the pairs before.
+    The buckets of the results are left sorted by the last score, as if they were sorted in place.
+ */
+void writeCounterReports(const AnalysisContext &ctx, AnalysisResults &results)
+{
+    const GameData &gd = ctx.gameData;
+#ifdef POGOPROTO_ZLIB
+    std::unique_ptr<CompressorPool> compressors;
+
+    if (ctx.conf.gzipLevel) compressors.reset(new CompressorPool(ctx.conf.gzipLevel));
+#endif
+    std::vector<std::unique_ptr<ReportFile>> files;
+
+    for (const CounterReport &report : COUNTER_REPORTS)
+    {
+        files.emplace_back(new ReportFile(counterReportFileName(report, ctx.conf).c_str(), ctx.conf.output));
+#ifdef POGOPROTO_ZLIB
+        if (compressors) files.back()->compress(*compressors);
+#endif
+        files.back()->write(report.title);
+    }
+
+    BoundedQueue<RankedBucket> ranked(2 * N_COUNTER_REPORTS);
+    BoundedQueue<ReportChunk> formatted(4 * N_COUNTER_REPORTS);
+    std::thread ranker;
+    std::thread formatter;
+
+    // Stops and joins the stages also when writing throws, the closed queues release producers blocked on them.
+    struct StageJoiner
+    {
+        BoundedQueue<RankedBucket> &ranked;
+        BoundedQueue<ReportChunk> &formatted;
+        std::thread &ranker;
+        std::thread &formatter;
+
+        ~StageJoiner()
+        {
+            ranked.close();
+            formatted.close();
+            if (ranker.joinable()) ranker.join();
+            if (formatter.joinable()) formatter.join();
+        }
+    } joiner = {ranked, formatted, ranker, formatter};
+
+    ranker = std::thread([&]()
+    {
+        for (auto &t1 : results.bestCounters)
+        {
+            for (auto &t2 : t1.second)
+            {
+                MovesetBucket bucket = t2.second;
+
+                for (size_t i = 0; i < N_COUNTER_REPORTS; i++)
+                {
+                    RankedBucket rb;
+
+                    results.sortBucket(bucket, COUNTER_REPORTS[i].key);
+                    rb.t1 = t1.first;
+                    rb.t2 = t2.first;
+                    rb.report = i;
+                    if (i + 1 < N_COUNTER_REPORTS) rb.bucket = bucket;
+                    else rb.bucket = std::move(bucket);
+                    rb.target = &t2.second;
+                    if (!ranked.push(std::move(rb))) return;
+                }
+            }
+        }
+        ranked.close();
+    });
+
+    formatter = std::thread([&]()
+    {
+        RankedBucket rb;
+
+        while (ranked.pop(rb))
+        {
+            ReportChunk chunk;
+
+            chunk.report = rb.report;
+            chunk.text.reserve(128 * (rb.bucket.size() + 1));
+            chunk.text = "Best counters of ";
+            chunk.text += gd.getTypeName(rb.t1);
+            chunk.text += '-';
+            chunk.text += gd.getTypeName(rb.t2);
+            chunk.text += "\n\n";
+            results.formatBucket(ctx, chunk.text, rb.bucket, COUNTER_REPORTS[rb.report].key);
+            chunk.text += "\n\n";
+            if (!formatted.push(std::move(chunk))) break;
+
+            // The ranker is done with the bucket once it sorted the copy by the last score.
+            if (rb.report + 1 == N_COUNTER_REPORTS)
+            {
+                std::copy(rb.bucket.rows.begin(), rb.bucket.rows.end(), rb.target->rows.begin());
+                std::copy(rb.bucket.rawDPS.begin(), rb.bucket.rawDPS.end(), rb.target->rawDPS.begin());
+                std::copy(rb.bucket.prestigerDPS.begin(), rb.bucket.prestigerDPS.end(), rb.target->prestigerDPS.begin());
+            }
+        }
+        formatted.close();
+    });
+
+    ReportChunk chunk;
+
+    while (formatted.pop(chunk))
+    {
+        files[chunk.report]->write(chunk.text.data(), chunk.text.size());
+    }
+    ranker.join();
+    formatter.join();
+
+    for (auto &file : files)
+    {
+        if (!file->close()) fprintf(stderr, "Writing %s failed.\n", file->getName().c_str());
+    }
+}
+
+/* Writes the moveset reports. */
+void writeMovesetReports(const AnalysisContext &ctx, AnalysisResults &results)
+{
+    const GameData &gd = ctx.gameData;
+    MovesetBucket overallMovesetStats = results.rowRange(0, results.movesets.size()); // Single bucket to sort all moveset stats
+    auto &movesetStatsByType = results.movesetStatsByType;
+
+    // Write the overall DPS list.
+    AutoFile dpsList = createReport("DPS.txt");
+    fprintf(dpsList, "Highest damage per second (moveset DPS * Attack)\n\n");
+    results.sortBucket(overallMovesetStats, ScoreKey::DPS);
+    results.printBucket(ctx, dpsList, overallMovesetStats, ScoreKey::DPS);
+
+    // Write the true power list.
+    AutoFile dtfList = createReport("DTF.txt");
+    fprintf(dtfList, "Highest damage till fainting (moveset DPS * Attack * Defense * Stamina)\n\n");
+    results.sortBucket(overallMovesetStats, ScoreKey::TRUE_POWER);
+    results.printBucket(ctx, dtfList, overallMovesetStats, ScoreKey::TRUE_POWER);
+
+    // Best DPS by Type
+    AutoFile bestAttackersByType = createReport("DPSbyType.txt");
+    fprintf(bestAttackersByType, "Highest damage per second per type\n\n");
+    for (auto &typeVecPair : movesetStatsByType)
+    {
+        results.sortBucket(typeVecPair.second, ScoreKey::DPS);
+    }
+
+    for (const auto &typeVecPair : movesetStatsByType)
+    {
+        fprintf(bestAttackersByType, "Best attackers of %s type:\n\n", gd.getTypeName(typeVecPair.first));
+        results.printBucket(ctx, bestAttackersByType, typeVecPair.second, ScoreKey::DPS);
+        fprintf(bestAttackersByType, "\n\n");
+    }
+
+    // Write best true power by type.
+    AutoFile bestDTFByType = createReport("DTFbyType.txt");
+    fprintf(bestDTFByType, "Highest damage tilll fainting per type\n\n");
+    for (auto &typeVecPair : movesetStatsByType)
+    {
+        results.sortBucket(typeVecPair.second, ScoreKey::TRUE_POWER);
+    }
+
+    for (const auto &typeVecPair : movesetStatsByType)
+    {
+        fprintf(bestDTFByType, "Best attackers of %s type:\n\n", gd.getTypeName(typeVecPair.first));
+        results.printBucket(ctx, bestDTFByType, typeVecPair.second, ScoreKey::TRUE_POWER);
+        fprintf(bestDTFByType, "\n\n");
+    }
+
+    writeCounterReports(ctx, results);
+}
+
+/* Indices of the points on the Pareto frontier (skyline) of (x, y), in decreasing order of x.
+    A point is on the frontier when no other point is at least as good in both and better in one.
+    After sorting by x (then y) in descending order a single sweep keeps the points whose y beats every y before them.
+    Of identical points only one is kept.
+ */
+std::vector<uint32_t> paretoFrontier(const std::vector<double> &x, const std::vector<double> &y)
+{
+    std::vector<uint32_t> order(x.size());
+    std::vector<uint32_t> frontier;
+
+    for (size_t i = 0; i < order.size(); i++) order[i] = i;
+
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b){return (x[a] > x[b]) || ((x[a] == x[b]) && (y[a] > y[b])); });
+
+    for (uint32_t i : order)
+    {
+        if (frontier.empty() || (y[i] > y[frontier.back()])) frontier.push_back(i);
+    }
+
+    return frontier;
+}
+
+/* Writes the DPS vs tankiness and DPS vs prestige power frontiers of the bucket. */
+void writeBucketFrontiers(const AnalysisContext &ctx, const AnalysisResults &results, FILE *f, const MovesetBucket &bucket)
+{
+    std::vector<double> dps(bucket.size());
+    std::vector<double> tankiness(bucket.size());
+    std::vector<double> prestige(bucket.size());
+
+    for (size_t i = 0; i < bucket.size(); i++)
+    {
+        dps[i] = results.getScore(bucket, i, ScoreKey::DPS);
+        tankiness[i] = results.pokemonById[results.movesets.pokemonIds[bucket.rows[i]]]->tankiness;
+        prestige[i] = results.getScore(bucket, i, ScoreKey::PRESTIGE_POWER);
+    }
+
+    fprintf(f, "DPS / tankiness:\n\n");
+    for (uint32_t i : paretoFrontier(dps, tankiness))
+    {
+        results.getEntry(bucket, i).printPair(ctx, f, dps[i], tankiness[i]);
+    }
+
+    fprintf(f, "\nDPS / prestige power:\n\n");
+    for (uint32_t i : paretoFrontier(dps, prestige))
+    {
+        results.getEntry(bucket, i).printPair(ctx, f, dps[i], prestige[i]);
+    }
+    fprintf(f, "\n\n");
+}
+
+/* Writes the movesets no other moveset beats in both offense and bulk (or prestige power). */
+void writeFrontierReports(const AnalysisContext &ctx, const AnalysisResults &results)
+{
+    const GameData &gd = ctx.gameData;
+
+    {
+        AutoFile frontierFile = createReport("frontier.txt");
+        fprintf(frontierFile, "Movesets not beaten in both DPS and tankiness (or DPS and prestige power) by any other moveset.\n\n");
+
+        writeBucketFrontiers(ctx, results, frontierFile, results.rowRange(0, results.movesets.size()));
+    }
+
+    if (!ctx.conf.writeCounterFrontiers) return;
+
+    AutoFile counterFrontierFile = createReport("frontierCounters.txt");
+    fprintf(counterFrontierFile, "Movesets not beaten in both DPS and tankiness (or DPS and prestige power) against particular types.\n\n");
+
+    for (const auto &t1 : results.bestCounters)
+    {
+        for (const auto &t2 : t1.second)
+        {
+            fprintf(counterFrontierFile, "Frontier against %s-%s\n\n", gd.getTypeName(t1.first), gd.getTypeName(t2.first));
+            writeBucketFrontiers(ctx, results, counterFrontierFile, t2.second);
+        }
+    }
+}
+
+/* Type pairs covered by each moveset, a bit for each type pair the moveset is a top N counter of. */
+struct CoverageTable
+{
+    size_t nWords; // 64 bit words in a bitset.
+    std::vector<std::pair<int, int>> pairs; // Type pair of each bit.
+    std::vector<uint32_t> rows; // Moveset row of each bitset.
+    std::vector<uint64_t> bits; // The bitsets one after the other.
+
+    const uint64_t *get(size_t i) const {return &bits[i * nWords];}
+
+    int count(const uint64_t *set) const
+    {
+        int n = 0;
+
+        for (size_t w = 0; w < nWords; w++) n += popcount64(set[w]);
+
+        return n;
+    }
+
+    /* Number of bits in set b not in set a. */
+    int countNew(const uint64_t *a, const uint64_t *b) const
+    {
+        int n = 0;
+
+        for (size_t w = 0; w < nWords; w++) n += popcount64(b[w] & ~a[w]);
+
+        return n;
+    }
+
+    bool isSubset(const uint64_t *a, const uint64_t *b) const
+    {
+        for (size_t w = 0; w < nWords; w++)
+        {
+            if (a[w] & ~b[w]) return false;
+        }
+
+        return true;
+    }
+};
+
+/* Builds the coverage bitsets from the counter lists.
+    Movesets whose coverage is contained in another moveset's coverage are dropped, they are never needed in a smallest team.
+ */
+CoverageTable buildCoverage(const AnalysisResults &results, int topN)
+{
+    CoverageTable table;
+    std::map<uint32_t, std::vector<uint64_t>> coverageByRow;
+
+    for (const auto &t1 : results.bestCounters)
+    {
+        for (const auto &t2 : t1.second)
+        {
+            table.pairs.push_back(std::make_pair(t1.first, t2.first));
+        }
+    }
+    table.nWords = (table.pairs.size() + 63) / 64;
+
+    size_t bit = 0;
+    for (const auto &t1 : results.bestCounters)
+    {
+        for (const auto &t2 : t1.second)
+        {
+            for (uint32_t pos : results.topPositions(t2.second, ScoreKey::DPS, topN))
+            {
+                std::vector<uint64_t> &coverage = coverageByRow[t2.second.rows[pos]];
+
+                coverage.resize(table.nWords);
+                coverage[bit / 64] |= 1ULL << (bit % 64);
+            }
+            bit++;
+        }
+    }
+
+    std::vector<std::pair<uint32_t, const std::vector<uint64_t> *>> candidates;
+    for (const auto &kv : coverageByRow) candidates.push_back(std::make_pair(kv.first, &kv.second));
+
+    for (size_t i = 0; i < candidates.size(); i++)
+    {
+        bool dominated = false;
+
+        for (size_t j = 0; (j < candidates.size()) && !dominated; j++)
+        {
+            if (i == j) continue;
+
+            const uint64_t *a = &(*candidates[i].second)[0];
+            const uint64_t *b = &(*candidates[j].second)[0];
+
+            // Of equal sets keep the first.
+            dominated = table.isSubset(a, b) && (!table.isSubset(b, a) || (j < i));
+        }
+
+        if (dominated) continue;
+
+        table.rows.push_back(candidates[i].first);
+        table.bits.insert(table.bits.end(), candidates[i].second->begin(), candidates[i].second->end());
+    }
+
+    return table;
+}
+
+/* Greedy set cover: repeatedly takes the moveset covering the most uncovered type pairs. */
+std::vector<uint32_t> greedyTeam(const CoverageTable &table)
+{
+    std::vector<uint64_t> covered(table.nWords);
+    std::vector<uint32_t> team;
+
+    for (;;)
+    {
+        int bestGain = 0;
+        size_t best = 0;
+
+        for (size_t i = 0; i < table.rows.size(); i++)
+        {
+            int gain = table.countNew(&covered[0], table.get(i));
+
+            if (gain > bestGain)
+            {
+                bestGain = gain;
+                best = i;
+            }
+        }
+
+        if (!bestGain) break;
+
+        team.push_back(best);
+        for (size_t w = 0; w < table.nWords; w++) covered[w] |= table.get(best)[w];
+    }
+
+    return team;
+}
+
+/* Depth first search for a cover with the given number of movesets.
+    It branches on the uncovered type pair with the fewest candidates, and cuts when the biggest coverage can't cover the rest.
+ */
+class ExactTeamSearch
+{
+    const CoverageTable &table;
+    std::vector<std::vector<uint32_t>> candidates; // Movesets covering each type pair.
+    int maxCoverage;
+    size_t nodes;
+    size_t nodeLimit;
+
+    bool isCovered(const std::vector<uint64_t> &covered, size_t bit) const {return (covered[bit / 64] >> (bit % 64)) & 1;}
+
+    bool search(const std::vector<uint64_t> &covered, int nCovered, size_t teamSize, std::vector<uint32_t> &team)
+    {
+        if (nCovered == (int)table.pairs.size()) return true;
+        if (team.size() == teamSize) return false;
+        if (++nodes > nodeLimit) return false;
+        if (table.pairs.size() - nCovered > (teamSize - team.size()) * maxCoverage) return false;
+
+        size_t branchBit = 0;
+        size_t fewest = (size_t)-1;
+
+        for (size_t bit = 0; bit < table.pairs.size(); bit++)
+        {
+            if (!isCovered(covered, bit) && (candidates[bit].size() < fewest))
+            {
+                fewest = candidates[bit].size();
+                branchBit = bit;
+            }
+        }
+
+        std::vector<uint64_t> next(table.nWords);
+
+        for (uint32_t c : candidates[branchBit])
+        {
+            for (size_t w = 0; w < table.nWords; w++) next[w] = covered[w] | table.get(c)[w];
+
+            team.push_back(c);
+            if (search(next, table.count(&next[0]), teamSize, team)) return true;
+            team.pop_back();
+        }
+
+        return false;
+    }
+
+public:
+    ExactTeamSearch(const CoverageTable &table, size_t nodeLimit) : table(table), candidates(table.pairs.size()), maxCoverage(0), nodes(0), nodeLimit(nodeLimit)
+    {
+        for (size_t i = 0; i < table.rows.size(); i++)
+        {
+            maxCoverage = std::max(maxCoverage, table.count(table.get(i)));
+            for (size_t bit = 0; bit < table.pairs.size(); bit++)
+            {
+                if ((table.get(i)[bit / 64] >> (bit % 64)) & 1) candidates[bit].push_back(i);
+            }
+        }
+    }
+
+    bool limitReached() const {return nodes > nodeLimit;}
+
+    /* Looks for a team of the given size. */
+    bool find(size_t teamSize, std::vector<uint32_t> &team)
+    {
+        std::vector<uint64_t> covered(table.nWords);
+
+        team.clear();
+
+        return search(covered, 0, teamSize, team);
+    }
+};
+
+const size_t TEAM_SEARCH_NODE_LIMIT = 20000000;
+
+void writeTeam(const AnalysisContext &ctx, const AnalysisResults &results, FILE *f, const CoverageTable &table, const std::vector<uint32_t> &team)
+{
+    const GameData &gd = ctx.gameData;
+
+    for (uint32_t member : team)
+    {
+        uint32_t row = table.rows[member];
+        MovesetBucket bucket = results.rowRange(row, row + 1);
+
+        results.getEntry(bucket, 0).printEntry(ctx, f, results.getScore(bucket, 0, ScoreKey::DPS));
+        fprintf(f, "\tTop counter of:");
+        for (size_t bit = 0; bit < table.pairs.size(); bit++)
+        {
+            if ((table.get(member)[bit / 64] >> (bit % 64)) & 1)
+            {
+                fprintf(f, " %s-%s", gd.getTypeName(table.pairs[bit].first), gd.getTypeName(table.pairs[bit].second));
+            }
+        }
+        fprintf(f, "\n");
+    }
+    fprintf(f, "\n");
+}
+
+/* Searches the smallest set of movesets that has a top N counter (by DPS) against every type combination. */
+void writeTeamReport(const AnalysisContext &ctx, const AnalysisResults &results)
+{
+    int topN = ctx.conf.teamTopN;
+    CoverageTable table = buildCoverage(results, topN);
+    AutoFile teamFile = createReport("team.txt");
+
+    fprintf(teamFile, "Smallest team with a top %d counter against every type combination.\n\n", topN);
+
+    std::vector<uint32_t> greedy = greedyTeam(table);
+    std::vector<uint64_t> covered(table.nWords);
+
+    for (uint32_t member : greedy)
+    {
+        for (size_t w = 0; w < table.nWords; w++) covered[w] |= table.get(member)[w];
+    }
+
+    if (table.count(&covered[0]) < (int)table.pairs.size())
+    {
+        fprintf(teamFile, "Some type combinations have no counters.\n");
+        return;
+    }
+
+    // Try smaller and smaller teams than the greedy one.
+    ExactTeamSearch search(table, TEAM_SEARCH_NODE_LIMIT);
+    std::vector<uint32_t> best = greedy;
+    std::vector<uint32_t> team;
+    bool proven = true;
+
+    while (best.size() > 1)
+    {
+        if (search.find(best.size() - 1, team))
+        {
+            best = team;
+        }
+        else
+        {
+            proven = !search.limitReached();
+            break;
+        }
+    }
+
+    fprintf(teamFile, "Team of %zu movesets (%s):\n\n", best.size(), proven ? "no smaller team exists" : "search limit reached, a smaller team may exist");
+    writeTeam(ctx, results, teamFile, table, best);
+
+    if (best.size() < greedy.size())
+    {
+        fprintf(teamFile, "Greedy team of %zu movesets:\n\n", greedy.size());
+        writeTeam(ctx, results, teamFile, table, greedy);
+    }
+}
+
+/* Measures the phases of a run for the -time option. */
+class PhaseTimer
+{
+    bool enabled;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    PhaseTimer(bool enabled) : enabled(enabled), start(std::chrono::steady_clock::now()) {}
+
+    /* Prints the time since the previous phase ended. */
+    void phaseDone(const char *name)
+    {
+        auto now = std::chrono::steady_clock::now();
+
+        if (enabled) printf("%-20s %10.3f ms\n", name, std::chrono::duration<double, std::milli>(now - start).count());
+        start = now;
+    }
+};
+
+/* Writes the report files of the bucketed movesets. */
+void writeReports(const AnalysisContext &ctx, AnalysisResults &results, PhaseTimer &timer)
+{
+    writePokemonRankings(ctx);
+    timer.phaseDone("Pokemon rankings");
+    writeMoveList(ctx);
+    timer.phaseDone("Move list");
+    writePokemonList(ctx, results);
+    timer.phaseDone("Pokemon list");
+    writeMovesetReports(ctx, results);
+    timer.phaseDone("Moveset reports");
+    if (ctx.conf.writeFrontier)
+    {
+        writeFrontierReports(ctx, results);
+        timer.phaseDone("Frontier reports");
+    }
+    if (ctx.conf.teamTopN > 0)
+    {
+        writeTeamReport(ctx, results);
+        timer.phaseDone("Team search");
+    }
+}
+
+/* Runs the whole analysis and writes all the report files.
+    The parsed -query, if any, runs last. Movesets restored from the -cache are not simulated again, nor are the reports written if they were restored too.
+ */
+void runAnalysis(const AnalysisContext &ctx, AnalysisResults &results, const CounterQuery *query = NULL, bool restored = false, bool reportsRestored = false)
+{
+    PhaseTimer timer(ctx.conf.printTimes);
+
+    if (!restored)
+    {
+        simulateMovesets(ctx, results);
+        timer.phaseDone("Simulation");
+    }
+    if (!reportsRestored || query)
+    {
+        fillBuckets(ctx, results);
+        timer.phaseDone("Buckets");
+    }
+    if (!reportsRestored) writeReports(ctx, results, timer);
+    if (query)
+    {
+        buildMovesetIndex(ctx, results);
+        timer.phaseDone("Moveset index");
+        runQuery(ctx, results, *query);
+        timer.phaseDone("Query");
+    }
+}
+
+/* C API, see pogoproto.h */
+
+struct PogoGameData
+{
+    GameData gameData;
+};
+
+struct PogoAnalysis
+{
+    AnalysisContext ctx;
+    AnalysisResults results;
+
+    PogoAnalysis(const GameData &gameData, const Config &conf) : ctx(gameData, conf) {}
+};
+
+struct PogoGameIndex
+{
+    LazyGameData lazy;
+
+    PogoGameIndex(const uint8_t *data, size_t size) : lazy(data, size) {}
+};
+
+static int toScoreKey(int sortKey, ScoreKey &key)
+{
+    switch (sortKey)
+    {
+        case POGO_SORT_DPS: key = ScoreKey::DPS; return POGO_OK;
+        case POGO_SORT_TRUE_POWER: key = ScoreKey::TRUE_POWER; return POGO_OK;
+        case POGO_SORT_PRESTIGE_POWER: key = ScoreKey::PRESTIGE_POWER; return POGO_OK;
+    }
+
+    return POGO_INVALID_ARGUMENT;
+}
+
+static void toPogoMoveset(const MovesetDPS &mdps, PogoMoveset *out)
+{
+    out->pokemonId = mdps.pokemonId;
+    out->fastId = mdps.fastId;
+    out->chargedId = mdps.chargedId;
+    out->isLegacy = mdps.isLegacy;
+    out->dodging = mdps.dodging;
+    out->fastAttacksPerTurn = mdps.fastAttacksPerTurn;
+    out->nChargedUsed = mdps.nChargedUsed;
+    out->DPS = mdps.DPS;
+    out->msDPS = mdps.msDPS;
+    out->truePower = mdps.truePower;
+    out->prestigePower = mdps.prestigePower;
+}
+
+static Config toConfig(const PogoConfig *conf)
+{
+    Config c;
+
+    c.roundLength = conf->roundLength;
+    c.lifeTime = conf->lifeTime;
+    c.battleTime = conf->battleTime;
+    c.prestigerCP = conf->prestigerCP;
+    c.verbose = false;
+
+    return c;
+}
+
+/* Simulates the moveset, against the types unless they are 0. */
+static void queryMoveset(const AnalysisContext &ctx, const PokemonInfo &pi, const MoveInfo &fastMove, const MoveInfo &chargedMove, bool legacy, int type1, int type2, PogoMoveset *result)
+{
+    DamageInfo dmg;
+    DamageInfo dmgPrestiger;
+    MovesetDPS mDPS = simulateMoveset(ctx, pi, fastMove, chargedMove, legacy, false, dmg, dmgPrestiger);
+
+    if (type1)
+    {
+        double theDPS;
+        double thePrestigerDPS;
+
+        counterDPS(ctx.gameData, fastMove, chargedMove, dmg, dmgPrestiger, type1, type2, theDPS, thePrestigerDPS);
+        mDPS.populate(theDPS, thePrestigerDPS, pi);
+    }
+
+    toPogoMoveset(mDPS, result);
+}
+
+/* Tells if the contents of a -lm file list the move for the pokémon. */
+static bool isLegacyMove(const char *legacyMoves, const std::string &pokemonName, const std::string &moveName)
+{
+    if (!legacyMoves) return false;
+
+    std::istringstream pairs(legacyMoves);
+    std::string pokemon;
+    std::string move;
+
+    while (pairs >> pokemon >> move)
+    {
+        if ((pokemon == pokemonName) && (move == moveName)) return true;
+    }
+
+    return false;
+}
+
+static int copyName(const std::string &name, char *buf, size_t bufSize, size_t *required)
+{
+    if (required) *required = name.size() + 1;
+    if (!buf || (bufSize < name.size() + 1)) return POGO_BUFFER_TOO_SMALL;
+
+    memcpy(buf, name.c_str(), name.size() + 1);
+
+    return POGO_OK;
+}
+
+static int findByName(const ArenaMap<std::string, int> &names, const char *name, int *id)
+{
+    if (!name || !id) return POGO_INVALID_ARGUMENT;
+
+    auto it = names.find(name);
+    if (it == names.end()) return POGO_NOT_FOUND;
+
+    *id = it->second;
+
+    return POGO_OK;
+}
+
+extern "C"
+{
+
+POGO_API void pogo_default_config(PogoConfig *conf)
+{
+    Config defaults;
+
+    conf->roundLength = defaults.roundLength;
+    conf->lifeTime = defaults.lifeTime;
+    conf->battleTime = defaults.battleTime;
+    conf->prestigerCP = defaults.prestigerCP;
+    conf->filteredPokemon = NULL;
+    conf->legacyMoves = NULL;
+}
+
+POGO_API const char *pogo_status_string(int status)
+{
+    switch (status)
+    {
+        case POGO_OK: return "OK";
+        case POGO_INVALID_ARGUMENT: return "Invalid argument.";
+        case POGO_PARSE_ERROR: return "Invalid game master.";
+        case POGO_NOT_FOUND: return "Not found.";
+        case POGO_BUFFER_TOO_SMALL: return "Buffer too small.";
+        case POGO_INTERNAL_ERROR: return "Internal error.";
+    }
+
+    return "Unknown status.";
+}
+
+POGO_API int pogo_load_game_master(const void *data, size_t size, PogoGameData **gameData)
+{
+    return pogo_load_game_master_at(data, size, gameData, NULL);
+}
+
+POGO_API int pogo_load_game_master_at(const void *data, size_t size, PogoGameData **gameData, size_t *errorOffset)
+{
+    if (!data || !gameData) return POGO_INVALID_ARGUMENT;
+
+    *gameData = NULL;
+    PogoGameData *result = NULL;
+
+    try
+    {
+        DecodeError error;
+
+        result = new PogoGameData();
+        if (decodeGameData(result->gameData, (const uint8_t *)data, size, error) != DecodeStatus::OK)
+        {
+            if (errorOffset) *errorOffset = error.at - (const uint8_t *)data;
+            delete result;
+            return POGO_PARSE_ERROR;
+        }
+    }
+    catch (const std::bad_alloc &)
+    {
+        delete result;
+        return POGO_INTERNAL_ERROR;
+    }
+    catch (...)
+    {
+        delete result;
+        return POGO_PARSE_ERROR;
+    }
+
+    *gameData = result;
+
+    return POGO_OK;
+}
+
+POGO_API void pogo_free_game_data(PogoGameData *gameData)
+{
+    delete gameData;
+}
+
+POGO_API int pogo_find_pokemon(const PogoGameData *gameData, const char *name, int *id)
+{
+    if (!gameData) return POGO_INVALID_ARGUMENT;
+
+    return findByName(gameData->gameData.pokemonNameToId, name, id);
+}
+
+POGO_API int pogo_find_move(const PogoGameData *gameData, const char *name, int *id)
+{
+    if (!gameData) return POGO_INVALID_ARGUMENT;
+
+    return findByName(gameData->gameData.moveNameToId, name, id);
+}
+
+POGO_API int pogo_find_type(const PogoGameData *gameData, const char *name, int *id)
+{
+    if (!gameData || !name || !id) return POGO_INVALID_ARGUMENT;
+
+    for (const auto &kv : gameData->gameData.typeNames)
+    {
+        if (kv.second == name)
+        {
+            *id = kv.first;
+            return POGO_OK;
+        }
+    }
+
+    return POGO_NOT_FOUND;
+}
+
+POGO_API int pogo_pokemon_name(const PogoGameData *gameData, int id, char *buf, size_t bufSize, size_t *required)
+{
+    if (!gameData) return POGO_INVALID_ARGUMENT;
+
+    auto it = gameData->gameData.pokemonList.find(id);
+    if (it == gameData->gameData.pokemonList.end()) return POGO_NOT_FOUND;
+
+    return copyName(it->second.name, buf, bufSize, required);
+}
+
+POGO_API int pogo_move_name(const PogoGameData *gameData, int id, char *buf, size_t bufSize, size_t *required)
+{
+    if (!gameData) return POGO_INVALID_ARGUMENT;
+
+    auto it = gameData->gameData.moveList.find(id);
+    if (it == gameData->gameData.moveList.end()) return POGO_NOT_FOUND;
+
+    return copyName(it->second.name, buf, bufSize, required);
+}
+
+POGO_API int pogo_create_analysis(const PogoGameData *gameData, const PogoConfig *conf, PogoAnalysis **analysis)
+{
+    if (!gameData || !conf || !analysis) return POGO_INVALID_ARGUMENT;
+
+    *analysis = NULL;
+    PogoAnalysis *result = NULL;
+
+    try
+    {
+        result = new PogoAnalysis(gameData->gameData, toConfig(conf));
+
+        if (conf->filteredPokemon)
+        {
+            std::istringstream filters(conf->filteredPokemon);
+
+            loadFilteredPokemon(result->ctx, filters);
+        }
+
+        if (setupAnalysis(result->ctx))
+        {
+            delete result;
+            return POGO_INVALID_ARGUMENT;
+        }
+
+        if (conf->legacyMoves)
+        {
+            std::istringstream legacy(conf->legacyMoves);
+
+            if (loadLegacyMoves(result->ctx, legacy))
+            {
+                delete result;
+                return POGO_INVALID_ARGUMENT;
+            }
+        }
+
+        computeResults(result->ctx, result->results);
+    }
+    catch (...)
+    {
+        delete result;
+        return POGO_INTERNAL_ERROR;
+    }
+
+    *analysis = result;
+
+    return POGO_OK;
+}
+
+POGO_API void pogo_free_analysis(PogoAnalysis *analysis)
+{
+    delete analysis;
+}
+
+POGO_API int pogo_query_moveset(const PogoAnalysis *analysis, int pokemonId, int fastId, int chargedId, int type1, int type2, PogoMoveset *result)
+{
+    if (!analysis || !result) return POGO_INVALID_ARGUMENT;
+
+    try
+    {
+        const AnalysisContext &ctx = analysis->ctx;
+        const GameData &gd = ctx.gameData;
+
+        auto piIt = ctx.pokemonList.find(pokemonId);
+        if (piIt == ctx.pokemonList.end()) return POGO_NOT_FOUND;
+
+        const PokemonInfo &pi = piIt->second;
+        auto fastIt = std::find(pi.fastMoves.begin(), pi.fastMoves.end(), fastId);
+        auto chargedIt = std::find(pi.chargedMoves.begin(), pi.chargedMoves.end(), chargedId);
+
+        if ((fastIt == pi.fastMoves.end()) || (chargedIt == pi.chargedMoves.end())) return POGO_NOT_FOUND;
+        if (((type1 == 0) != (type2 == 0))) return POGO_INVALID_ARGUMENT;
+
+        bool legacy =
+            ((size_t)(fastIt - pi.fastMoves.begin()) >= pi.nAvailableFastMoves)
+            || ((size_t)(chargedIt - pi.chargedMoves.begin()) >= pi.nAvailableChargedMoves);
+
+        queryMoveset(ctx, pi, gd.getMove(fastId), gd.getMove(chargedId), legacy, type1, type2, result);
+    }
+    catch (...)
+    {
+        return POGO_INTERNAL_ERROR;
+    }
+
+    return POGO_OK;
+}
+
+POGO_API int pogo_top_counters(const PogoAnalysis *analysis, int type1, int type2, int sortKey, PogoMoveset *results, size_t k, size_t *count)
+{
+    if (!analysis || !count || (!results && k)) return POGO_INVALID_ARGUMENT;
+
+    *count = 0;
+
+    try
+    {
+        auto &bestCounters = analysis->results.bestCounters;
+
+        if (type1 > type2) std::swap(type1, type2);
+
+        auto t1 = bestCounters.find(type1);
+        if (t1 == bestCounters.end()) return POGO_NOT_FOUND;
+        auto t2 = t1->second.find(type2);
+        if (t2 == t1->second.end()) return POGO_NOT_FOUND;
+
+        ScoreKey key;
+
+        if (toScoreKey(sortKey, key)) return POGO_INVALID_ARGUMENT;
+
+        std::vector<uint32_t> top = analysis->results.topPositions(t2->second, key, k);
+
+        for (size_t i = 0; i < top.size(); i++)
+        {
+            toPogoMoveset(analysis->results.getEntry(t2->second, top[i]), results + i);
+        }
+        *count = top.size();
+    }
+    catch (...)
+    {
+        return POGO_INTERNAL_ERROR;
+    }
+
+    return POGO_OK;
+}
+
+POGO_API void pogo_default_filter(PogoFilter *filter)
+{
+    if (!filter) return;
+
+    memset(filter, 0, sizeof(*filter));
+    filter->legacy = -1;
+    filter->dodging = -1;
+}
+
+POGO_API int pogo_top_counters_filtered(const PogoAnalysis *analysis, int type1, int type2, int sortKey, const PogoFilter *filter, PogoMoveset *results, size_t k, size_t *count)
+{
+    if (!analysis || !filter || !count || (!results && k)) return POGO_INVALID_ARGUMENT;
+    if ((filter->nMoveTypes && !filter->moveTypes) || (filter->nPokemonTypes && !filter->pokemonTypes) || (filter->nExcludedPokemon && !filter->excludedPokemon)) return POGO_INVALID_ARGUMENT;
+
+    *count = 0;
+
+    try
+    {
+        auto &bestCounters = analysis->results.bestCounters;
+
+        if (type1 > type2) std::swap(type1, type2);
+
+        auto t1 = bestCounters.find(type1);
+        if (t1 == bestCounters.end()) return POGO_NOT_FOUND;
+        auto t2 = t1->second.find(type2);
+        if (t2 == t1->second.end()) return POGO_NOT_FOUND;
+
+        ScoreKey key;
+
+        if (toScoreKey(sortKey, key)) return POGO_INVALID_ARGUMENT;
+
+        MovesetFilter f;
+
+        f.legacy = filter->legacy;
+        f.dodging = filter->dodging;
+        f.moveTypes.assign(filter->moveTypes, filter->moveTypes + filter->nMoveTypes);
+        f.pokemonTypes.assign(filter->pokemonTypes, filter->pokemonTypes + filter->nPokemonTypes);
+        f.minMaxCP = filter->minMaxCP;
+        f.excludedPokemon.assign(filter->excludedPokemon, filter->excludedPokemon + filter->nExcludedPokemon);
+
+        std::vector<uint32_t> top = analysis->results.topPositions(t2->second, key, k, analysis->results.selectRows(f));
+
+        for (size_t i = 0; i < top.size(); i++)
+        {
+            toPogoMoveset(analysis->results.getEntry(t2->second, top[i]), results + i);
+        }
+        *count = top.size();
+    }
+    catch (...)
+    {
+        return POGO_INTERNAL_ERROR;
+    }
+
+    return POGO_OK;
+}
+
+POGO_API int pogo_index_game_master(const void *data, size_t size, PogoGameIndex **index, size_t *errorOffset)
+{
+    if (!data || !index) return POGO_INVALID_ARGUMENT;
+
+    *index = NULL;
+    PogoGameIndex *result = NULL;
+
+    try
+    {
+        DecodeError error;
+
+        result = new PogoGameIndex((const uint8_t *)data, size);
+        if (result->lazy.buildIndex(error) != DecodeStatus::OK)
+        {
+            if (errorOffset) *errorOffset = error.at - (const uint8_t *)data;
+            delete result;
+            return POGO_PARSE_ERROR;
+        }
+    }
+    catch (const std::bad_alloc &)
+    {
+        delete result;
+        return POGO_INTERNAL_ERROR;
+    }
+    catch (...)
+    {
+        delete result;
+        return POGO_PARSE_ERROR;
+    }
+
+    *index = result;
+
+    return POGO_OK;
+}
+
+POGO_API void pogo_free_game_index(PogoGameIndex *index)
+{
+    delete index;
+}
+
+POGO_API int pogo_index_find_pokemon(const PogoGameIndex *index, const char *name, int *id)
+{
+    if (!index || !name || !id) return POGO_INVALID_ARGUMENT;
+
+    int found = index->lazy.findPokemon(name);
+    if (found < 0) return POGO_NOT_FOUND;
+
+    *id = found;
+
+    return POGO_OK;
+}
+
+POGO_API int pogo_index_find_move(const PogoGameIndex *index, const char *name, int *id)
+{
+    if (!index || !name || !id) return POGO_INVALID_ARGUMENT;
+
+    int found = index->lazy.findMove(name);
+    if (found < 0) return POGO_NOT_FOUND;
+
+    *id = found;
+
+    return POGO_OK;
+}
+
+POGO_API int pogo_index_find_type(PogoGameIndex *index, const char *name, int *id)
+{
+    if (!index || !name || !id) return POGO_INVALID_ARGUMENT;
+
+    try
+    {
+        DecodeError error;
+
+        if (index->lazy.tryLoadTypes(error) != DecodeStatus::OK) return POGO_PARSE_ERROR;
+
+        for (const auto &kv : index->lazy.getCache().typeNames)
+        {
+            if (kv.second == name)
+            {
+                *id = kv.first;
+                return POGO_OK;
+            }
+        }
+    }
+    catch (...)
+    {
+        return POGO_INTERNAL_ERROR;
+    }
+
+    return POGO_NOT_FOUND;
+}
+
+POGO_API int pogo_index_query_moveset(PogoGameIndex *index, const PogoConfig *conf, int pokemonId, int fastId, int chargedId, int type1, int type2, PogoMoveset *result)
+{
+    if (!index || !conf || !result) return POGO_INVALID_ARGUMENT;
+    if (((type1 == 0) != (type2 == 0))) return POGO_INVALID_ARGUMENT;
+
+    try
+    {
+        LazyGameData &lazy = index->lazy;
+        DecodeError error;
+        const PokemonInfo *pokemon;
+        const MoveInfo *fastMove;
+        const MoveInfo *chargedMove;
+
+        if ((lazy.tryGetPokemon(pokemonId, pokemon, error) != DecodeStatus::OK)
+            || (lazy.tryGetMove(fastId, fastMove, error) != DecodeStatus::OK)
+            || (lazy.tryGetMove(chargedId, chargedMove, error) != DecodeStatus::OK)
+            || (type1 && (lazy.tryLoadTypes(error) != DecodeStatus::OK)))
+        {
+            return POGO_PARSE_ERROR;
+        }
+        if (!pokemon || !fastMove || !chargedMove) return POGO_NOT_FOUND;
+
+        AnalysisContext ctx(lazy.getCache(), toConfig(conf));
+        PokemonInfo pi = *pokemon;
+        bool legacy = false;
+
+        pi.prestigerCPMultiplier = prestigerCPMultiplier(pi, ctx.conf.prestigerCP);
+
+        if (std::find(pi.fastMoves.begin(), pi.fastMoves.end(), fastId) == pi.fastMoves.end())
+        {
+            if (!isLegacyMove(conf->legacyMoves, pi.name, fastMove->name)) return POGO_NOT_FOUND;
+            legacy = true;
+        }
+        if (std::find(pi.chargedMoves.begin(), pi.chargedMoves.end(), chargedId) == pi.chargedMoves.end())
+        {
+            if (!isLegacyMove(conf->legacyMoves, pi.name, chargedMove->name)) return POGO_NOT_FOUND;
+            legacy = true;
+        }
+
+        queryMoveset(ctx, pi, *fastMove, *chargedMove, legacy, type1, type2, result);
+    }
+    catch (...)
+    {
+        return POGO_INTERNAL_ERROR;
+    }
+
+    return POGO_OK;
+}
+
+}
+
+/* Streaming inflater of raw deflate data (RFC 1951) held in memory.
+    The output is produced on demand by read() through a 32 KB window, so the inflated data never has to be in memory as a whole.
+    The Huffman codes are decoded canonically bit by bit, as in zlib's puff.
+ */
+class Inflater
+{
+    static const int MAX_BITS = 15;
+    static const int MAX_LCODES = 286;
+    static const int MAX_DCODES = 30;
+    static const int FIX_LCODES = 288;
+    static const size_t WINDOW_SIZE = 32768;
+
+    struct Huffman
+    {
+        short count[MAX_BITS + 1]; // Number of codes of each length.
+        short symbol[FIX_LCODES]; // Symbols ordered by code.
+    };
+
+    enum class State {HEADER, STORED, HUFFMAN, DONE, FAILED};
+
+    const uint8_t *in;
+    size_t inSize;
+    size_t inPos;
+    uint32_t bitBuf;
+    int bitCount;
+
+    uint8_t window[WINDOW_SIZE];
+    size_t outPos; // Number of bytes inflated so far.
+
+    State state;
+    bool lastBlock;
+    size_t storedLeft; // Bytes left of a stored block.
+    int copyLength; // Bytes left of a match.
+    int copyDistance;
+    Huffman lengthCode;
+    Huffman distanceCode;
+
+    bool getBits(int need, int &value)
+    {
+        while (bitCount < need)
+        {
+            if (inPos == inSize) return false;
+
+            bitBuf |= (uint32_t)in[inPos++] << bitCount;
+            bitCount += 8;
+        }
+
+        value = bitBuf & ((1u << need) - 1);
+        bitBuf >>= need;
+        bitCount -= need;
+
+        return true;
+    }
+
+    /* Decodes a symbol, -1 on error. */
+    int decode(const Huffman &h)
+    {
+        int code = 0; // Bits read so far.
+        int first = 0; // First code of the current length.
+        int index = 0; // Index of the first code of the current length in the symbols.
+
+        for (int len = 1; len <= MAX_BITS; len++)
+        {
+            int bit;
+
+            if (!getBits(1, bit)) return -1;
+            code |= bit;
+
+            int count = h.count[len];
+
+            if (code - count < first) return h.symbol[index + (code - first)];
+            index += count;
+            first += count;
+            first <<= 1;
+            code <<= 1;
+        }
+
+        return -1;
+    }
+
+    /* Builds the decoding tables from the code lengths.
+        Returns 0 for a complete code, negative for an over-subscribed and positive for an incomplete one.
+     */
+    static int construct(Huffman &h, const short *length, int n)
+    {
+        short offs[MAX_BITS + 1];
+
+        for (int len = 0; len <= MAX_BITS; len++) h.count[len] = 0;
+        for (int symbol = 0; symbol < n; symbol++) h.count[length[symbol]]++;
+        if (h.count[0] == n) return 0;
+
+        int left = 1;
+
+        for (int len = 1; len <= MAX_BITS; len++)
+        {
+            left <<= 1;
+            left -= h.count[len];
+            if (left < 0) return left;
+        }
+
+        offs[1] = 0;
+        for (int len = 1; len < MAX_BITS; len++) offs[len + 1] = offs[len] + h.count[len];
+        for (int symbol = 0; symbol < n; symbol++)
+        {
+            if (length[symbol]) h.symbol[offs[length[symbol]]++] = symbol;
+        }
+
+        return left;
+    }
+
+    bool fixedCodes()
+    {
+        short lengths[FIX_LCODES];
+        int symbol = 0;
+
+        for (; symbol < 144; symbol++) lengths[symbol] = 8;
+        for (; symbol < 256; symbol++) lengths[symbol] = 9;
+        for (; symbol < 280; symbol++) lengths[symbol] = 7;
+        for (; symbol < FIX_LCODES; symbol++) lengths[symbol] = 8;
+        construct(lengthCode, lengths, FIX_LCODES);
+
+        for (symbol = 0; symbol < MAX_DCODES; symbol++) lengths[symbol] = 5;
+        construct(distanceCode, lengths, MAX_DCODES);
+
+        return true;
+    }
+
+    bool dynamicCodes()
+    {
+        static const short order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+        short lengths[MAX_LCODES + MAX_DCODES];
+        int nLen, nDist, nCode;
+
+        if (!getBits(5, nLen) || !getBits(5, nDist) || !getBits(4, nCode)) return false;
+        nLen += 257;
+        nDist += 1;
+        nCode += 4;
+        if ((nLen > MAX_LCODES) || (nDist > MAX_DCODES)) return false;
+
+        int index;
+
+        for (index = 0; index < nCode; index++)
+        {
+            int len;
+
+            if (!getBits(3, len)) return false;
+            lengths[order[index]] = len;
+        }
+        for (; index < 19; index++) lengths[order[index]] = 0;
+
+        if (construct(lengthCode, lengths, 19)) return false; // The code length code must be complete.
+
+        for (index = 0; index < nLen + nDist; )
+        {
+            int symbol = decode(lengthCode);
+            int len = 0;
+            int repeat;
+
+            if (symbol < 0) return false;
+            if (symbol < 16)
+            {
+                lengths[index++] = symbol;
+                continue;
+            }
+
+            if (symbol == 16)
+            {
+                if (!index) return false; // Nothing to repeat.
+                len = lengths[index - 1];
+                if (!getBits(2, repeat)) return false;
+                repeat += 3;
+            }
+            else if (symbol == 17)
+            {
+                if (!getBits(3, repeat)) return false;
+                repeat += 3;
+            }
+            else
+            {
+                if (!getBits(7, repeat)) return false;
+                repeat += 11;
+            }
+
+            if (index + repeat > nLen + nDist) return false;
+            while (repeat--) lengths[index++] = len;
+        }
+
+        if (!lengths[256]) return false; // No end of block code.
+
+        // Incomplete codes are only allowed for a single length.
+        int err = construct(lengthCode, lengths, nLen);
+        if ((err < 0) || ((err > 0) && (nLen - lengthCode.count[0] != 1))) return false;
+
+        err = construct(distanceCode, lengths + nLen, nDist);
+        if ((err < 0) || ((err > 0) && (nDist - distanceCode.count[0] != 1))) return false;
+
+        return true;
+    }
+
+    /* Reads the header of the next block. */
+    bool startBlock()
+    {
+        int type;
+        int last;
+
+        if (lastBlock)
+        {
+            state = State::DONE;
+            return true;
+        }
+        if (!getBits(1, last) || !getBits(2, type)) return false;
+        lastBlock = last;
+
+        switch (type)
+        {
+            case 0:
+                {
+                    // Stored block, byte aligned.
+                    bitBuf = 0;
+                    bitCount = 0;
+                    if (inSize - inPos < 4) return false;
+
+                    unsigned len = in[inPos] | (in[inPos + 1] << 8);
+                    unsigned complement = in[inPos + 2] | (in[inPos + 3] << 8);
+
+                    if (len != (~complement & 0xFFFF)) return false;
+                    inPos += 4;
+                    storedLeft = len;
+                    state = State::STORED;
+                }
+                return true;
+            case 1:
+                state = State::HUFFMAN;
+                return fixedCodes();
+            case 2:
+                state = State::HUFFMAN;
+                return dynamicCodes();
+        }
+
+        return false;
+    }
+
+    /* Reads the match after a length symbol. */
+    bool startCopy(int symbol)
+    {
+        static const short lengthBase[29] = {
+            3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+        static const short lengthExtra[29] = {
+            0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+        static const short distanceBase[30] = {
+            1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+        static const short distanceExtra[30] = {
+            0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+        int extra;
+
+        symbol -= 257;
+        if (symbol >= 29) return false;
+        if (!getBits(lengthExtra[symbol], extra)) return false;
+        copyLength = lengthBase[symbol] + extra;
+
+        symbol = decode(distanceCode);
+        if ((symbol < 0) || (symbol >= 30)) return false;
+        if (!getBits(distanceExtra[symbol], extra)) return false;
+        copyDistance = distanceBase[symbol] + extra;
+
+        return (size_t)copyDistance <= outPos;
+    }
+
+    void put(uint8_t *out, size_t &produced, uint8_t byte)
+    {
+        out[produced++] = byte;
+        window[outPos++ % WINDOW_SIZE] = byte;
+    }
+
+    Inflater(const Inflater &) = delete;
+    Inflater &operator=(const Inflater &) = delete;
+
+public:
+    Inflater(const uint8_t *in, size_t n) :
+        in(in), inSize(n), inPos(0), bitBuf(0), bitCount(0), outPos(0),
+        state(State::HEADER), lastBlock(false), storedLeft(0), copyLength(0), copyDistance(0)
+    {
+    }
+
+    /* Inflates up to n bytes, less only at the end of the data or on error. */
+    size_t read(uint8_t *out, size_t n)
+    {
+        size_t produced = 0;
+
+        while (produced < n)
+        {
+            if (copyLength)
+            {
+                put(out, produced, window[(outPos - copyDistance) % WINDOW_SIZE]);
+                copyLength--;
+                continue;
+            }
+
+            switch (state)
+            {
+                case State::HEADER:
+                    if (!startBlock()) state = State::FAILED;
+                    break;
+                case State::STORED:
+                    if (!storedLeft)
+                    {
+                        state = State::HEADER;
+                    }
+                    else if (inPos == inSize)
+                    {
+                        state = State::FAILED;
+                    }
+                    else
+                    {
+                        put(out, produced, in[inPos++]);
+                        storedLeft--;
+                    }
+                    break;
+                case State::HUFFMAN:
+                    {
+                        int symbol = decode(lengthCode);
+
+                        if (symbol < 0) state = State::FAILED;
+                        else if (symbol < 256) put(out, produced, symbol);
+                        else if (symbol == 256) state = State::HEADER;
+                        else if (!startCopy(symbol)) state = State::FAILED;
+                    }
+                    break;
+                case State::DONE:
+                case State::FAILED:
+                    return produced;
+            }
+        }
+
+        return produced;
+    }
+
+    bool failed() const {return state == State::FAILED;}
+
+    /* Number of bytes inflated so far. */
+    size_t getTotalOut() const {return outPos;}
+};
+
+/* Read only view of a whole file, memory mapped where the platform allows. */
+class MappedFile
+{
+    const uint8_t *data;
+    size_t size;
+    bool mapped;
+    std::vector<uint8_t> copy; // The contents when not mapped.
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+public:
+    /* The file must be seekable. */
+    MappedFile(FILE *f) : data(NULL), size(0), mapped(false)
+    {
+#ifndef _WIN32
+        struct stat st;
+
+        if (!fstat(fileno(f), &st) && (st.st_size > 0))
+        {
+            void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+
+            if (p != MAP_FAILED)
+            {
+                data = (const uint8_t *)p;
+                size = st.st_size;
+                mapped = true;
+                return;
+            }
+        }
+#endif
+        fseek(f, 0, SEEK_END);
+        long fileSize = ftell(f);
+        fseek(f, 0, SEEK_SET);
+
+        if (fileSize > 0)
+        {
+            copy.resize(fileSize);
+            copy.resize(fread(&copy[0], 1, fileSize, f));
+        }
+        data = copy.data();
+        size = copy.size();
+    }
+
+    ~MappedFile()
+    {
+#ifndef _WIN32
+        if (mapped) munmap((void *)data, size);
+#endif
+    }
+
+    const uint8_t *getData() const {return data;}
+    size_t getSize() const {return size;}
+};
+
+/* A file in a zip archive. The data points into the archive. */
+struct ZipEntry
+{
+    std::string name;
+    int method; // 0 for stored, 8 for deflated.
+    const uint8_t *data;
+    size_t compressedSize;
+    size_t size;
+};
+
+const int ZIP_STORED = 0;
+const int ZIP_DEFLATED = 8;
+
+inline uint32_t zipGet16(const uint8_t *p) {return p[0] | (p[1] << 8);}
+inline uint32_t zipGet32(const uint8_t *p) {return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);}
+
+inline bool isZip(const uint8_t *data, size_t n)
+{
+    return (n >= 4) && (zipGet32(data) == 0x04034b50);
+}
+
+/* Lists the entries of a zip archive from its central directory. Returns false if the archive is malformed or uses zip64. */
+bool readZipDirectory(const uint8_t *zip, size_t n, std::vector<ZipEntry> &entries)
+{
+    const size_t EOCD_SIZE = 22;
+    const size_t CENTRAL_HEADER_SIZE = 46;
+    const size_t LOCAL_HEADER_SIZE = 30;
+
+    if (n < EOCD_SIZE) return false;
+
+    // The end of central directory record is followed by a comment of at most 64 KB.
+    size_t eocd = n - EOCD_SIZE;
+
+    while (zipGet32(zip + eocd) != 0x06054b50)
+    {
+        if (!eocd || (n - EOCD_SIZE - eocd >= 0xFFFF)) return false;
+        eocd--;
+    }
+
+    size_t nEntries = zipGet16(zip + eocd + 10);
+    size_t dirOffset = zipGet32(zip + eocd + 16);
+    size_t pos = dirOffset;
+
+    for (size_t i = 0; i < nEntries; i++)
+    {
+        if ((pos > n) || (n - pos < CENTRAL_HEADER_SIZE) || (zipGet32(zip + pos) != 0x02014b50)) return false;
+
+        const uint8_t *header = zip + pos;
+        size_t nameLength = zipGet16(header + 28);
+        size_t extraLength = zipGet16(header + 30);
+        size_t commentLength = zipGet16(header + 32);
+        size_t localOffset = zipGet32(header + 42);
+        ZipEntry entry;
+
+        if (n - pos - CENTRAL_HEADER_SIZE < nameLength) return false;
+
+        entry.name.assign((const char *)header + CENTRAL_HEADER_SIZE, nameLength);
+        entry.method = zipGet16(header + 10);
+        entry.compressedSize = zipGet32(header + 20);
+        entry.size = zipGet32(header + 24);
+        if ((entry.compressedSize == 0xFFFFFFFF) || (entry.size == 0xFFFFFFFF) || (localOffset == 0xFFFFFFFF)) return false; // Zip64
+
+        // The data follows the local header, whose name and extra field lengths may differ from the central directory.
+        if ((localOffset > n) || (n - localOffset < LOCAL_HEADER_SIZE) || (zipGet32(zip + localOffset) != 0x04034b50)) return false;
+
+        size_t dataOffset = localOffset + LOCAL_HEADER_SIZE + zipGet16(zip + localOffset + 26) + zipGet16(zip + localOffset + 28);
+
+        if ((dataOffset > n) || (n - dataOffset < entry.compressedSize)) return false;
+        entry.data = zip + dataOffset;
+
+        entries.push_back(entry);
+        pos += CENTRAL_HEADER_SIZE + nameLength + extraLength + commentLength;
+    }
+
+    return true;
+}
+
+/* Entry with the given name, or if name is NULL the first one with GAME_MASTER in its file name. */
+const ZipEntry *findGameMasterEntry(const std::vector<ZipEntry> &entries, const char *name)
+{
+    for (const ZipEntry &entry : entries)
+    {
+        if (name)
+        {
+            if (entry.name == name) return &entry;
+        }
+        else
+        {
+            size_t slash = entry.name.rfind('/');
+            std::string fileName = slash == std::string::npos ? entry.name : entry.name.substr(slash + 1);
+
+            if (fileName.find("GAME_MASTER") != std::string::npos) return &entry;
+        }
+    }
+
+    return NULL;
+}
+
+#ifndef POGOPROTO_LIBRARY
+
+/* Finds the game master in the archive, see -entry. Prints the error and returns NULL if there is none. */
+const ZipEntry *openGameMasterEntry(const MappedFile &file, const char *entryName, std::vector<ZipEntry> &entries)
+{
+    if (!readZipDirectory(file.getData(), file.getSize(), entries))
+    {
+        fprintf(stderr, "Malformed or zip64 archive.\n");
+        return NULL;
+    }
+
+    const ZipEntry *entry = findGameMasterEntry(entries, entryName);
+
+    if (!entry) fprintf(stderr, "No game master in the archive.\n");
+
+    return entry;
+}
+
+/* Parses the game master in a zip archive, an APK or a data.zip.
+    Stored entries are parsed in place, deflated ones are inflated straight into the parser.
+ */
+int loadGameMasterFromZip(GameData &gameData, const MappedFile &file, const char *entryName)
+{
+    std::vector<ZipEntry> entries;
+    const ZipEntry *entry = openGameMasterEntry(file, entryName, entries);
+
+    if (!entry) return 1;
+
+    DecodeStatus status;
+    size_t errorOffset = 0;
+
+    if (entry->method == ZIP_STORED)
+    {
+        DecodeError error;
+
+        status = decodeGameData(gameData, entry->data, entry->size, error);
+        if (status != DecodeStatus::OK) errorOffset = error.at - entry->data;
+    }
+    else if (entry->method == ZIP_DEFLATED)
+    {
+        Inflater inflater(entry->data, entry->compressedSize);
+
+        status = decodeGameDataStream(gameData, inflater, errorOffset);
+        if (inflater.failed() || ((status == DecodeStatus::OK) && (inflater.getTotalOut() != entry->size)))
+        {
+            fprintf(stderr, "Corrupt compressed data in %s.\n", entry->name.c_str());
+            return 1;
+        }
+    }
+    else
+    {
+        fprintf(stderr, "Unsupported compression method %d of %s.\n", entry->method, entry->name.c_str());
+        return 1;
+    }
+
+    if (status != DecodeStatus::OK)
+    {
+        fprintf(stderr, "Malformed game master at offset %zu of %s.\n", errorOffset, entry->name.c_str());
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Reads and parses the game master. Files are mapped, pipes are parsed while reading. */
+int loadGameMaster(GameData &gameData, FILE *f, const Config &conf)
+{
+    DecodeStatus status;
+    size_t errorOffset = 0;
+
+    if (fseek(f, 0, SEEK_SET))
+    {
+        FileReader reader(f);
+
+        status = decodeGameDataStream(gameData, reader, errorOffset);
+    }
+    else
+    {
+        MappedFile file(f);
+        DecodeError error;
+
+        if (isZip(file.getData(), file.getSize())) return loadGameMasterFromZip(gameData, file, conf.zipEntry);
+
+        status = decodeGameData(gameData, file.getData(), file.getSize(), error);
+        if (status != DecodeStatus::OK) errorOffset = error.at - file.getData();
+    }
+
+    if (status != DecodeStatus::OK)
+    {
+        fprintf(stderr, "Malformed game master at offset %zu.\n", errorOffset);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Reads everything the reader has. */
+template <typename Reader>
+void readAll(Reader &reader, std::vector<uint8_t> &contents)
+{
+    const size_t CHUNK_SIZE = 64 * 1024;
+
+    for (;;)
+    {
+        size_t old = contents.size();
+
+        contents.resize(old + CHUNK_SIZE);
+        size_t got = reader.read(&contents[old], CHUNK_SIZE);
+        contents.resize(old + got);
+
+        if (got < CHUNK_SIZE) break;
+    }
+}
+
+/* Writes dump.txt or dump.json. */
+int dumpGameData(const uint8_t *data, size_t n, const Config &conf)
+{
+    bool json = conf.dump == DumpFormat::JSON;
+    const char *fileName = json ? DUMP_JSON_FILE : DUMP_TEXT_FILE;
+    AutoFile f = fopen(fileName, "w");
+    BufferedWriter out(f);
+    ProtoDumper dumper(out, json);
+    DecodeError error;
+
+    if (dumper.dump(data, n, error) != DecodeStatus::OK)
+    {
+        fprintf(stderr, "Malformed game master at offset %zu, %s ends there.\n", (size_t)(error.at - data), fileName);
+        out.flush();
+        return 1;
+    }
+    if (!out.flush())
+    {
+        fprintf(stderr, "Writing %s failed.\n", fileName);
+        return 1;
+    }
+
+    printf("%s has been written.\n", fileName);
+
+    return 0;
+}
+
+/* The whole game master in memory: a mapped file, the contents of a pipe or an inflated archive entry. */
+class GameMasterBytes
+{
+    std::unique_ptr<MappedFile> file;
+    std::vector<uint8_t> contents; // Read from a pipe, inflated or patched.
+    const uint8_t *data;
+    size_t size;
+
+    int useContents()
+    {
+        data = contents.data();
+        size = contents.size();
+
+        return 0;
+    }
+
+public:
+    GameMasterBytes() : data(NULL), size(0) {}
+
+    /* Reads the game master, see -entry for archives. Prints the error and returns nonzero on failure. */
+    int load(FILE *f, const Config &conf)
+    {
+        if (fseek(f, 0, SEEK_SET))
+        {
+            FileReader reader(f);
+
+            readAll(reader, contents);
+
+            return useContents();
+        }
+
+        file.reset(new MappedFile(f));
+        data = file->getData();
+        size = file->getSize();
+
+        if (!isZip(data, size)) return 0;
+
+        std::vector<ZipEntry> entries;
+        const ZipEntry *entry = openGameMasterEntry(*file, conf.zipEntry, entries);
+
+        if (!entry) return 1;
+        if (entry->method == ZIP_STORED)
+        {
+            data = entry->data;
+            size = entry->size;
+            return 0;
+        }
+        if (entry->method != ZIP_DEFLATED)
+        {
+            fprintf(stderr, "Unsupported compression method %d of %s.\n", entry->method, entry->name.c_str());
+            return 1;
+        }
+
+        Inflater inflater(entry->data, entry->compressedSize);
+
+        readAll(inflater, contents);
+        if (inflater.failed() || (contents.size() != entry->size))
+        {
+            fprintf(stderr, "Corrupt compressed data in %s.\n", entry->name.c_str());
+            return 1;
+        }
+
+        return useContents();
+    }
+
+    /* Replaces the game master, eg. with the patched one. */
+    void replace(std::vector<uint8_t> &&bytes)
+    {
+        contents = std::move(bytes);
+        useContents();
+    }
+
+    const uint8_t *getData() const {return data;}
+    size_t getSize() const {return size;}
+};
+
+/* A field -patch can change. */
+struct PatchField
+{
+    const char *name;
+    bool pokemon; // Pokémon base stat or move field.
+    int tag;
+    WireType type;
+};
+
+const PatchField PATCH_FIELDS[] = {
+    {"power", false, (int)MoveDetailsTag::POWER, WireType::BIT32},
+    {"duration", false, (int)MoveDetailsTag::DURATION, WireType::VARINT},
+    {"energy", false, (int)MoveDetailsTag::ENERGY, WireType::VARINT},
+    {"stamina", true, (int)BaseStatsTag::STAMINA, WireType::VARINT},
+    {"attack", true, (int)BaseStatsTag::ATTACK, WireType::VARINT},
+    {"defense", true, (int)BaseStatsTag::DEFENSE, WireType::VARINT}
+};
+
+/* Reads the name, field, value triplets of a patch file. Returns nonzero on error. */
+int loadPatch(std::istream &ifs, GameMasterPatch &patch)
+{
+    std::string name;
+    std::string fieldName;
+    std::string value;
+
+    while (ifs >> name)
+    {
+        if (!(ifs >> fieldName >> value))
+        {
+            fprintf(stderr, "Incomplete patch of %s.\n", name.c_str());
+            return 1;
+        }
+
+        const PatchField *field = std::find_if(std::begin(PATCH_FIELDS), std::end(PATCH_FIELDS), [&fieldName](const PatchField &f) {return fieldName == f.name;});
+
+        if (field == std::end(PATCH_FIELDS))
+        {
+            fprintf(stderr, "Unknown field in the patch of %s: %s\n", name.c_str(), fieldName.c_str());
+            return 1;
+        }
+
+        Message msg;
+        char *end;
+
+        msg.tag = field->tag;
+        msg.type = field->type;
+        if (field->type == WireType::BIT32)
+        {
+            float f = strtof(value.c_str(), &end);
+
+            memcpy(msg.data.fixed, &f, 4);
+        }
+        else
+        {
+            // Negative values, like the energy of charged moves, are 10 byte varints.
+            msg.data.varInt = (uint64_t)strtoll(value.c_str(), &end, 10);
+        }
+        if (*end)
+        {
+            fprintf(stderr, "Invalid value in the patch of %s: %s\n", name.c_str(), value.c_str());
+            return 1;
+        }
+
+        if (field->pokemon) patch.pokemon[name].baseStats[field->tag] = msg;
+        else patch.moves[name].fields[field->tag] = msg;
+    }
+
+    return 0;
+}
+
+/* Encodes the game master with the patch file of the configuration applied. Returns nonzero on error. */
+int patchGameMaster(const GameMasterBytes &bytes, const Config &conf, ProtoEncoder &out)
+{
+    GameMasterPatch patch;
+    std::ifstream ifs(conf.patchFile);
+
+    if (!ifs)
+    {
+        fprintf(stderr, "Cannot open %s.\n", conf.patchFile);
+        return 1;
+    }
+    if (loadPatch(ifs, patch)) return 1;
+
+    DecodeError error;
+
+    if (encodePatchedGameMaster(out, bytes.getData(), bytes.getSize(), patch, error) != DecodeStatus::OK)
+    {
+        fprintf(stderr, "Malformed game master at offset %zu.\n", (size_t)(error.at - bytes.getData()));
+        return 1;
+    }
+
+    for (const auto &kv : patch.pokemon)
+    {
+        if (!kv.second.applied && conf.verbose) printf("No such pokemon: %s\n", kv.first.c_str());
+    }
+    for (const auto &kv : patch.moves)
+    {
+        if (!kv.second.applied && conf.verbose) printf("No such move: %s\n", kv.first.c_str());
+    }
+
+    return 0;
+}
+
+/* Writes the encoded game master, see -write. */
+int writeGameMaster(const ProtoEncoder &encoded, const char *fileName)
+{
+    AutoFile f = fopen(fileName, "wb");
+
+    if (!encoded.write(f) || fflush(f))
+    {
+        fprintf(stderr, "Writing %s failed.\n", fileName);
+        return 1;
+    }
+
+    printf("%s has been written.\n", fileName);
+
+    return 0;
+}
+
+/* Fast non-cryptographic 64 bit hash of the -cache keys. */
+class Hasher
+{
+    uint64_t h;
+
+    void addWord(uint64_t word)
+    {
+        h ^= word * 0x87c37b91114253d5ULL;
+        h = ((h << 31) | (h >> 33)) * 0x4cf5ad432745937fULL;
+    }
+
+public:
+    Hasher() : h(0x9e3779b97f4a7c15ULL) {}
+
+    /* Adds the bytes and their length, so consecutive pieces can not be mistaken for differently split ones. */
+    void add(const void *data, size_t n)
+    {
+        const uint8_t *p = (const uint8_t *)data;
+        size_t length = n;
+
+        for (; n >= 8; p += 8, n -= 8)
+        {
+            uint64_t word;
+
+            memcpy(&word, p, 8);
+            addWord(word);
+        }
+        if (n)
+        {
+            uint64_t word = 0;
 
-    if (moveInfo.energy <= 0)
-    {
-        pokemonList[pokemonNameToId[pokemonName]].chargedMoves.push_back(moveNameToId[moveName]);
+            memcpy(&word, p, n);
+            addWord(word);
+        }
+        addWord(length);
     }
-    else
+
+    template <typename T>
+    void addValue(const T &value) {add(&value, sizeof(value));}
+
+    /* Adds the contents of the file, or a marker if it can not be read. */
+    void addFile(const char *fileName)
     {
-        pokemonList[pokemonNameToId[pokemonName]].fastMoves.push_back(moveNameToId[moveName]);
-    }
-}
+        std::ifstream f;
 
-const double LEVEL30_CP_MULTIPLIER = 0.7317;
-const double LEVEL40_CP_MULTIPLIER = 0.79030001;
-const char *POKEMON_LIST_FILE = "pokemonlist.txt";
-const char *MOVE_LIST_FILE= "moves.txt";
+        if (fileName) f.open(fileName, std::ios::binary);
+        if (!f.is_open())
+        {
+            addValue(false);
+            return;
+        }
 
-const double ATTACKER_CPM = LEVEL30_CP_MULTIPLIER; // Corresponding CP multiplier for level 30 pokémon.
+        std::stringstream contents;
 
-struct Config
-{
-    const char *gameMasterFile;
-    double roundLength; // How often the opponent strikes.
-    double lifeTime; // How long life assumed.
-    double battleTime; // Length of the battle;
-    double prestigerCP; // The desired CP of the prestiger.
-    const char *filteredPokemon; // List of pokemon to filter out. eg. legendaries or other unobtainable stuff.
-    const char *legacyMoves; // File containing legacy moves.
-    const char *highlightPokemonName; // Pokemon to highlight and write more stats to stdout when dumping.
+        contents << f.rdbuf();
+        addValue(true);
+        add(contents.str().data(), contents.str().size());
+    }
 
-    Config()
+    /* The MurmurHash3 finalizer of the state. */
+    uint64_t get() const
     {
-        gameMasterFile = NULL;
-        roundLength = 2.5;
-        lifeTime = 100;
-        battleTime = 100;
-        prestigerCP = 1500;
-        filteredPokemon = NULL;
-        legacyMoves = NULL;
-        highlightPokemonName = NULL;
-    }
-} conf;
+        uint64_t x = h;
 
-struct Option
-{
-    int nParameters;
-    std::string helpText;
-    int (*handler)(char **argv);
-};
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ULL;
+        x ^= x >> 33;
 
-typedef int (*OptHandlerFunc)(const char *option);
+        return x;
+    }
+};
 
-std::map<std::string, Option> options;
+// Entries of other builds are not trusted, the simulation may have changed.
+const char *CACHE_VERSION = "pogoproto results 1 " __DATE__ " " __TIME__;
+const char *CACHE_RESULTS_FILE = "results.bin";
+const char CACHE_MAGIC[8] = {'P', 'O', 'G', 'O', 'R', 'E', 'S', '1'};
 
-void printHelp()
+int makeDirectory(const std::string &path)
 {
-    printf("Pokémon GO protobuff analyzer. It takes the Pokémon GO protobuff file located on your phone, and output some analysis files into TXT files.\n\n");
-    printf("USAGE:\n\npogoproto filename [options]\n\n");
-    printf("OPTIONS:\n\n");
+#ifdef _WIN32
+    return _mkdir(path.c_str());
+#else
+    return mkdir(path.c_str(), 0777);
+#endif
+}
 
-    for (const auto &opt : options)
-    {
-        puts(opt.second.helpText.c_str());
-    }
+int removeDirectory(const std::string &path)
+{
+#ifdef _WIN32
+    return _rmdir(path.c_str());
+#else
+    return rmdir(path.c_str());
+#endif
 }
 
-struct DamageInfo
+int processId()
 {
-    double primaryDPS;
-    double secondaryDPS;
-    double time;
-    int expectedHitsPerTurn;
-    int chargedsUsed;
-};
+#ifdef _WIN32
+    return _getpid();
+#else
+    return getpid();
+#endif
+}
 
-DamageInfo calculateDPS(const PokemonInfo &pi, const MoveInfo &fastMove, const MoveInfo &chargedMove, double cpMultiplier, bool highlighted)
+/* Hard links the file, or copies it where links are not supported. */
+bool linkOrCopy(const std::string &from, const std::string &to)
 {
-    double energy = 0;
+#ifndef _WIN32
+    if (!link(from.c_str(), to.c_str())) return true;
+#endif
 
-    DamageInfo dmg;
+    FILE *in = fopen(from.c_str(), "rb");
 
-    dmg.time = 0;
-    double primaryDamage = 0;
-    double secondaryDamage = 0;
+    if (!in) return false;
 
-    double damage = 0;
+    FILE *out = fopen(to.c_str(), "wb");
+    bool ok = out != NULL;
+    char buf[64 * 1024];
+    size_t n;
 
-    dmg.expectedHitsPerTurn = floor((conf.roundLength - 0.49) / fastMove.duration);
-    bool dodging = dmg.expectedHitsPerTurn > 0;
+    while (ok && (n = fread(buf, 1, sizeof(buf), in))) ok = fwrite(buf, 1, n, out) == n;
+    ok = ok && !ferror(in);
+    if (out && fclose(out)) ok = false;
+    fclose(in);
 
-    double extraEnergy = 0.5*((pi.baseStamina + 15) * cpMultiplier);
+    return ok;
+}
 
-    if (highlighted)
+/* Report files written with the configuration. */
+std::vector<std::string> reportFileNames(const Config &conf)
+{
+    std::vector<std::string> names = {
+        "cplist.txt", "tankiness.txt", "truestrength.txt", MOVE_LIST_FILE, POKEMON_LIST_FILE,
+        "DPS.txt", "DTF.txt", "DPSbyType.txt", "DTFbyType.txt"
+    };
+
+    for (const CounterReport &report : COUNTER_REPORTS) names.push_back(counterReportFileName(report, conf));
+
+    if (conf.writeFrontier) names.push_back("frontier.txt");
+    if (conf.writeFrontier && conf.writeCounterFrontiers) names.push_back("frontierCounters.txt");
+    if (conf.teamTopN > 0) names.push_back("team.txt");
+
+    return names;
+}
+
+/* Results of earlier runs in the -cache directory.
+    Each entry is a directory named by the hash of everything the reports depend on: the (patched) game master,
+    the simulation options and the contents of the -filt and -lm files. It holds the moveset store and hard links to the reports.
+ */
+class ResultCache
+{
+    std::string entry; // Directory of the entry, empty if the cache is not used.
+
+public:
+    /* Looks up the entry of the game master. -hlm prints from the simulation, so the cache is not used with it. */
+    void open(const Config &conf, const uint8_t *data, size_t size)
     {
-        printf("\n\n%s with moveset: %s + %s\n", pi.name.c_str(), fastMove.name.c_str(), chargedMove.name.c_str());
-        printf("extraEnergy: %g\n", extraEnergy);
-        printf("ExpectedHitsPerTurn: %d\n", dmg.expectedHitsPerTurn);
+        if (!conf.cacheDir || conf.highlightPokemonName) return;
+
+        Hasher hasher;
+        char key[17];
+
+        hasher.add(CACHE_VERSION, strlen(CACHE_VERSION));
+        hasher.add(data, size);
+        hasher.addValue(conf.roundLength);
+        hasher.addValue(conf.lifeTime);
+        hasher.addValue(conf.battleTime);
+        hasher.addValue(conf.prestigerCP);
+        hasher.addValue(conf.pruneDominated);
+        hasher.addValue(conf.writeFrontier);
+        hasher.addValue(conf.writeCounterFrontiers);
+        hasher.addValue(conf.teamTopN);
+        hasher.addValue(conf.gzipLevel);
+        hasher.addFile(conf.filteredPokemon);
+        hasher.addFile(conf.legacyMoves);
+        snprintf(key, sizeof(key), "%016llx", (unsigned long long)hasher.get());
+
+        entry = std::string(conf.cacheDir) + "/" + key;
     }
 
-    dmg.chargedsUsed = 0;
+    bool isUsed() const {return !entry.empty();}
 
-    while (dmg.time < conf.battleTime)
+    /* Replaces the reports in the working directory with links to the cached ones. False if there is no entry. */
+    bool linkReports(const Config &conf) const
     {
-        const MoveInfo *moveToUse;
-        double *damageToRaise;
-        double stab = 1;
-        int nConsecutiveHits;
-        double remTime;
+        if (!isUsed()) return false;
 
-        if (energy >= -chargedMove.energy)
-        {
-            // Do charged move.
-            moveToUse = &chargedMove;
-            damageToRaise = &secondaryDamage;
-            nConsecutiveHits = 1;
-            dmg.chargedsUsed++;
-        }
-        else
+        for (const std::string &name : reportFileNames(conf))
         {
-            // Do fast move
-            moveToUse = &fastMove;
-            damageToRaise = &primaryDamage;
-            remTime = conf.roundLength - fmod(dmg.time, conf.roundLength);
-            if (dodging)
-            {
-                nConsecutiveHits = floor(remTime / fastMove.duration);
-                if (nConsecutiveHits > dmg.expectedHitsPerTurn) nConsecutiveHits = dmg.expectedHitsPerTurn;
-            }
-            else
-            {
-                nConsecutiveHits = 1;
-            }
+            remove(name.c_str());
+            if (!linkOrCopy(entry + "/" + name, name)) return false;
         }
 
-        for (int tid : pi.pokemonTypes)
+        return true;
+    }
+
+    /* Restores the simulated movesets of the analysis. False if there is no valid entry. */
+    bool loadResults(const AnalysisContext &ctx, AnalysisResults &results) const
+    {
+        if (!isUsed()) return false;
+
+        FILE *f = fopen((entry + "/" + CACHE_RESULTS_FILE).c_str(), "rb");
+
+        if (!f) return false;
+
+        char magic[sizeof(CACHE_MAGIC)];
+        uint64_t nRows = 0;
+        long fileSize = 0;
+        bool ok = (fread(magic, sizeof(magic), 1, f) == 1) && !memcmp(magic, CACHE_MAGIC, sizeof(magic)) &&
+            (fread(&nRows, sizeof(nRows), 1, f) == 1) && !fseek(f, 0, SEEK_END) && ((fileSize = ftell(f)) >= 0) &&
+            ((uint64_t)fileSize == sizeof(magic) + sizeof(nRows) + nRows * MovesetStore::rowBytes()) &&
+            !fseek(f, sizeof(magic) + sizeof(nRows), SEEK_SET) && results.movesets.load(f, nRows);
+
+        fclose(f);
+        if (!ok) return false;
+
+        // The rows are in the order simulateMovesets() added them, the movesets of each pokémon together in id order.
+        const MovesetStore &movesets = results.movesets;
+        const GameData &gd = ctx.gameData;
+        uint32_t row = 0;
+
+        if (!ctx.pokemonList.empty()) results.pokemonById.resize(ctx.pokemonList.rbegin()->first + 1);
+        for (const auto &kv : ctx.pokemonList)
         {
-            if (moveToUse->moveType == tid)
+            uint32_t firstRow = row;
+
+            results.pokemonById[kv.first] = &kv.second;
+            for (; (row < nRows) && (movesets.pokemonIds[row] == kv.first); row++)
             {
-                stab = 1.25;
-                break;
+                if (!gd.moveList.count(movesets.fastIds[row]) || !gd.moveList.count(movesets.chargedIds[row])) return false;
             }
+            results.pokemonRows[kv.first] = std::make_pair(firstRow, row);
         }
 
-        damage += moveToUse->power * stab * nConsecutiveHits;
-        *damageToRaise += moveToUse->power * stab * nConsecutiveHits;
-        dmg.time += moveToUse->duration * nConsecutiveHits;
-        energy += moveToUse->energy * nConsecutiveHits;
-        energy += (moveToUse->duration / conf.lifeTime) * extraEnergy * nConsecutiveHits;
-        if (energy > 100) energy = 100;
-        if (highlighted)
+        return row == nRows;
+    }
+
+    /* Adds the results and the reports in the working directory as a new entry. Failures only leave the entry out. */
+    void store(const Config &conf, const AnalysisResults &results) const
+    {
+        if (!isUsed()) return;
+
+        // Built under a temporary name, so concurrent runs never see half written entries.
+        std::stringstream tmp;
+
+        tmp << entry << ".tmp" << processId();
+
+        std::string tmpDir = tmp.str();
+        std::vector<std::string> files = reportFileNames(conf);
+        bool ok = true;
+
+        makeDirectory(conf.cacheDir);
+        if (makeDirectory(tmpDir)) return;
+
+        for (const std::string &name : files)
         {
-            printf("%s used %s %d times (damage: %g, energy: %d, staminaEnergy: %g)\n",
-                pi.name.c_str(),
-                moveToUse->name.c_str(),
-                nConsecutiveHits,
-                moveToUse->power,
-                moveToUse->energy,
-                (moveToUse->duration / conf.lifeTime) * extraEnergy
-            );
-            printf("t: %g, primary dmg: %g, secondary dmg: %g, energy: %g\n", dmg.time, primaryDamage, secondaryDamage, energy);
+            ok = ok && linkOrCopy(name, tmpDir + "/" + name);
         }
-        if (dodging && moveToUse == &fastMove)
+        files.push_back(CACHE_RESULTS_FILE);
+        if (ok)
         {
-            remTime -= moveToUse->duration * nConsecutiveHits;
-            if (remTime < 0.5) remTime = 0.5;
-            dmg.time += remTime; // Time spent dodging.
-            if (highlighted)
-            {
-                printf("Then dodged for %g seconds.\n", remTime);
-                printf("t: %g, primary dmg: %g, secondary dmg: %g, energy: %g\n", dmg.time, primaryDamage, secondaryDamage, energy);
-            }
+            FILE *f = fopen((tmpDir + "/" + CACHE_RESULTS_FILE).c_str(), "wb");
+            uint64_t nRows = results.movesets.size();
+
+            ok = f && (fwrite(CACHE_MAGIC, sizeof(CACHE_MAGIC), 1, f) == 1) && (fwrite(&nRows, sizeof(nRows), 1, f) == 1) && results.movesets.save(f);
+            if (f && fclose(f)) ok = false;
         }
-        //fgetc(stdin);
-    }
 
-    dmg.primaryDPS = primaryDamage / dmg.time;
-    dmg.secondaryDPS = secondaryDamage / dmg.time;
+        if (ok && !rename(tmpDir.c_str(), entry.c_str())) return;
 
-    return dmg;
-}
+        // Failed, or another run stored the same entry first.
+        for (const std::string &name : files) remove((tmpDir + "/" + name).c_str());
+        removeDirectory(tmpDir);
+    }
+};
 
 int main(int argc, char **argv)
 {
@@ -629,6 +7027,8 @@ int main(int argc, char **argv)
         }
     }
 
+    Config conf;
+
     // Set up options.
 
     {
@@ -636,7 +7036,7 @@ int main(int argc, char **argv)
 
         option = &options["-rl"];
         option->nParameters = 1;
-        option->handler = [](char **argv)
+        option->handler = [](Config &conf, char **argv)
         {
             conf.roundLength = strtod(argv[1], NULL);
             printf("Using round length: %g\n", conf.roundLength);
@@ -653,7 +7053,7 @@ int main(int argc, char **argv)
 
         option = &options["-lt"];
         option->nParameters = 1;
-        option->handler = [](char **argv)
+        option->handler = [](Config &conf, char **argv)
         {
             conf.lifeTime = strtol(argv[1], NULL, 10);
             printf("Using life time: %g\n", conf.lifeTime);
@@ -670,7 +7070,7 @@ int main(int argc, char **argv)
 
         option = &options["-pcp"];
         option->nParameters = 1;
-        option->handler = [](char **argv)
+        option->handler = [](Config &conf, char **argv)
         {
             conf.prestigerCP = strtod(argv[1], NULL);
             printf("Preferred prestiger CP: %g\n", conf.prestigerCP);
@@ -687,7 +7087,7 @@ int main(int argc, char **argv)
 
         option = &options["-filt"];
         option->nParameters = 1;
-        option->handler = [](char **argv)
+        option->handler = [](Config &conf, char **argv)
         {
             conf.filteredPokemon = argv[1];
             printf("Filtering unwanted pokemon using file: %s\n", conf.filteredPokemon);
@@ -704,7 +7104,7 @@ int main(int argc, char **argv)
 
         option = &options["-lm"];
         option->nParameters = 1;
-        option->handler = [](char **argv)
+        option->handler = [](Config &conf, char **argv)
         {
             conf.legacyMoves = argv[1];
             printf("Adding legacy moves from: %s\n", conf.legacyMoves);
@@ -721,7 +7121,7 @@ int main(int argc, char **argv)
 
         option = &options["-hlm"];
         option->nParameters = 1;
-        option->handler = [](char **argv)
+        option->handler = [](Config &conf, char **argv)
         {
             conf.highlightPokemonName = argv[1];
             printf("The pokemon %s will be highlighted if exists!\n", argv[1]);
@@ -736,19 +7136,225 @@ int main(int argc, char **argv)
             option->helpText = tmp.str();
         }
 
-        option = &options["-bt"];
+        option = &options["-bt"];
+        option->nParameters = 1;
+        option->handler = [](Config &conf, char **argv)
+        {
+            conf.battleTime = strtod(argv[1], NULL);
+            printf("Using battle time: %g\n", conf.battleTime);
+            return 0;
+        };
+        {
+            std::stringstream tmp;
+            tmp << "-bt battleTime\n\n";
+            tmp << "\tSets the battle time. The moveset simulation runs for the specified time.\n\n";
+            tmp << "\tThe default is " << conf.battleTime << ".\n";
+            option->helpText = tmp.str();
+        }
+
+        option = &options["-prune"];
+        option->nParameters = 0;
+        option->handler = [](Config &conf, char **)
+        {
+            conf.pruneDominated = true;
+            printf("Dominated movesets are left out of the counter lists.\n");
+            return 0;
+        };
+        {
+            std::stringstream tmp;
+            tmp << "-prune\n\n";
+            tmp << "\tLeaves movesets out of the counter lists that another moveset of the same pokémon beats against every type.\n\n";
+            tmp << "\tThe other moveset must have the same move types and at least the same fast and charged move DPS.\n";
+            tmp << "\tThe best counters are the same, the lists get shorter and are computed faster.\n";
+            option->helpText = tmp.str();
+        }
+
+        option = &options["-frontier"];
+        option->nParameters = 0;
+        option->handler = [](Config &conf, char **)
+        {
+            conf.writeFrontier = true;
+            return 0;
+        };
+        {
+            std::stringstream tmp;
+            tmp << "-frontier\n\n";
+            tmp << "\tWrites frontier.txt with the movesets that no other moveset beats in both DPS and tankiness, or in both DPS and prestige power.\n\n";
+            tmp << "\tEvery other moveset is worse in both than one of the listed ones.\n";
+            option->helpText = tmp.str();
+        }
+
+        option = &options["-frontiercounters"];
+        option->nParameters = 0;
+        option->handler = [](Config &conf, char **)
+        {
+            conf.writeFrontier = true;
+            conf.writeCounterFrontiers = true;
+            return 0;
+        };
+        {
+            std::stringstream tmp;
+            tmp << "-frontiercounters\n\n";
+            tmp << "\tLike -frontier, and also writes frontierCounters.txt with the frontiers against each type combination.\n";
+            option->helpText = tmp.str();
+        }
+
+        option = &options["-team"];
+        option->nParameters = 1;
+        option->handler = [](Config &conf, char **argv)
+        {
+            conf.teamTopN = strtol(argv[1], NULL, 10);
+            if (conf.teamTopN <= 0) return 1;
+            printf("Searching team with top %d counters against every type combination.\n", conf.teamTopN);
+            return 0;
+        };
+        {
+            std::stringstream tmp;
+            tmp << "-team N\n\n";
+            tmp << "\tWrites team.txt with the smallest set of movesets that has one of the N best counters (by DPS) against every type combination.\n\n";
+            tmp << "\tThe search stops after " << TEAM_SEARCH_NODE_LIMIT << " steps, the file tells if the team is proven to be the smallest.\n";
+            option->helpText = tmp.str();
+        }
+
+        option = &options["-query"];
+        option->nParameters = 1;
+        option->handler = [](Config &conf, char **argv)
+        {
+            conf.query = argv[1];
+            return 0;
+        };
+        option->helpText =
+            "-query TERMS\n\n"
+            "\tPrints the best counters of a type combination among the movesets matching a filter.\n"
+            "\tThe terms are separated by commas, list values by |. Only vs is required.\n\n"
+            "\tvs=DRAGON-FLYING or vs=DRAGON: Defender types.\n"
+            "\ttop=N: Number of counters to print (10).\n"
+            "\tsort=dps|truepower|prestige: Order of the counters (dps).\n"
+            "\tlegacy=yes|no, dodging=yes|no: Only movesets that are or aren't legacy or dodging.\n"
+            "\tmovetype=WATER|ICE: Movesets with a move of one of the types.\n"
+            "\ttype=WATER|ICE: Pokemon of one of the types.\n"
+            "\tmincp=X: Pokemon with max CP of at least X.\n"
+            "\texclude=NAME|NAME: Pokemon to leave out.\n\n"
+            "\teg. -query vs=DRAGON-FLYING,legacy=no,type=WATER,mincp=2500,top=10\n";
+
+        option = &options["-entry"];
+        option->nParameters = 1;
+        option->handler = [](Config &conf, char **argv)
+        {
+            conf.zipEntry = argv[1];
+            return 0;
+        };
+        option->helpText =
+            "-entry NAME\n\n"
+            "\tWhen the game master file is a zip archive (an APK or a data.zip), the path of the game master in the archive.\n"
+            "\tBy default the first file with GAME_MASTER in its name is used.\n";
+
+        option = &options["-dump"];
+        option->nParameters = 1;
+        option->handler = [](Config &conf, char **argv)
+        {
+            if (!strcmp(argv[1], "text")) conf.dump = DumpFormat::TEXT;
+            else if (!strcmp(argv[1], "json")) conf.dump = DumpFormat::JSON;
+            else return 1;
+            return 0;
+        };
+        {
+            std::stringstream tmp;
+            tmp << "-dump text|json\n\n";
+            tmp << "\tInstead of the analysis, writes every field of the game master to " << DUMP_TEXT_FILE << " as an indented tree or to " << DUMP_JSON_FILE << ".\n";
+            tmp << "\tNo schema is used, so new fields show up too. The contents of length prefixed fields are guessed:\n";
+            tmp << "\ttext is a string, data parsing as fields is a message, else packed floats, packed varints or bytes.\n";
+            option->helpText = tmp.str();
+        }
+
+        option = &options["-patch"];
+        option->nParameters = 1;
+        option->handler = [](Config &conf, char **argv)
+        {
+            conf.patchFile = argv[1];
+            printf("Patching the game master with: %s\n", conf.patchFile);
+            return 0;
+        };
+        option->helpText =
+            "-patch FILE\n\n"
+            "\tChanges move and base stats of the game master before the analysis, for what-if comparisons.\n"
+            "\tThe file has whitespace separated NAME FIELD VALUE triplets, the names are the ones in the templates.\n"
+            "\tMove fields: power, duration (in ms), energy (negative for charged moves). Pokemon fields: attack, defense, stamina.\n\n"
+            "\teg. DRAGON_BREATH_FAST power 7 DRAGONITE attack 250\n";
+
+        option = &options["-write"];
+        option->nParameters = 1;
+        option->handler = [](Config &conf, char **argv)
+        {
+            conf.outputFile = argv[1];
+            return 0;
+        };
+        option->helpText =
+            "-write FILE\n\n"
+            "\tInstead of the analysis, writes the game master patched with -patch to FILE.\n"
+            "\tOnly the patched templates are encoded again, the other records are copied as they are.\n";
+
+        option = &options["-cache"];
+        option->nParameters = 1;
+        option->handler = [](Config &conf, char **argv)
+        {
+            conf.cacheDir = argv[1];
+            return 0;
+        };
+        option->helpText =
+            "-cache DIR\n\n"
+            "\tKeeps the simulated movesets and the reports in DIR. A later run with the same game master, options, -filt and -lm files\n"
+            "\tlinks the reports from there instead of simulating again. -query runs on the restored movesets. Not used with -hlm.\n"
+            "\tThe reports become hard links into DIR, replace them rather than edit them in place.\n";
+
+        option = &options["-output"];
+        option->nParameters = 1;
+        option->handler = [](Config &conf, char **argv)
+        {
+            if (!strcmp(argv[1], "stdio")) conf.output = OutputMethod::STDIO;
+            else if (!strcmp(argv[1], "pwrite")) conf.output = OutputMethod::PWRITE;
+            else if (!strcmp(argv[1], "uring")) conf.output = OutputMethod::URING;
+            else return 1;
+            return 0;
+        };
+        option->helpText =
+            "-output stdio|pwrite|uring\n\n"
+            "\tHow the counter reports, most of the output, are written. pwrite writes 1 MB blocks without stdio.\n"
+            "\turing (Linux) writes them asynchronously through io_uring with O_DIRECT where possible, else it falls back to pwrite.\n"
+            "\tDefault: stdio\n";
+
+        option = &options["-gzip"];
         option->nParameters = 1;
-        option->handler = [](char **argv)
+        option->handler = [](Config &conf, char **argv)
         {
-            conf.battleTime = strtod(argv[1], NULL);
-            printf("Using battle time: %g\n", conf.battleTime);
+#ifdef POGOPROTO_ZLIB
+            conf.gzipLevel = atoi(argv[1]);
+            return (conf.gzipLevel < 1) || (conf.gzipLevel > 9) ? 1 : 0;
+#else
+            (void)conf;
+            (void)argv;
+            fprintf(stderr, "-gzip needs a build with -DPOGOPROTO_ZLIB -lz.\n");
+            return 1;
+#endif
+        };
+        option->helpText =
+            "-gzip LEVEL\n\n"
+            "\tWrites the counter reports compressed as DPSCounters.txt.gz, DTFCounters.txt.gz and prestigers.txt.gz.\n"
+            "\tLEVEL is the zlib level from 1 (fastest) to 9 (smallest). Blocks of 1 MB are compressed on a thread per core.\n"
+            "\tNeeds a build with -DPOGOPROTO_ZLIB -lz.\n";
+
+        option = &options["-time"];
+        option->nParameters = 0;
+        option->handler = [](Config &conf, char **)
+        {
+            conf.printTimes = true;
             return 0;
         };
         {
             std::stringstream tmp;
-            tmp << "-bt battleTime\n\n";
-            tmp << "\tSets the battle time. The moveset simulation runs for the specified time.\n\n";
-            tmp << "\tThe default is " << conf.battleTime << ".\n";
+            tmp << "-time\n\n";
+            tmp << "\tPrints the time spent parsing, simulating and writing each report.\n\n";
+            tmp << "\tUse it to compare the speed of builds on the same game master.\n";
             option->helpText = tmp.str();
         }
     }
@@ -785,7 +7391,7 @@ int main(int argc, char **argv)
             }
             else
             {
-                if (opt->second.handler(argv + i))
+                if (opt->second.handler(conf, argv + i))
                 {
                     fprintf(stderr, "Error in option %s\n", opt->first.c_str());
                     return 1;
@@ -800,628 +7406,126 @@ int main(int argc, char **argv)
         return 1;
     }
 
+    GameData gameData;
+    AnalysisContext ctx(gameData, conf);
+
     // Filter legendaries.
     if (conf.filteredPokemon)
     {
         std::ifstream filters(conf.filteredPokemon);
-        std::string name;
 
-        while (filters >> name)
-        {
-            printf("Filtering %s\n", name.c_str());
-            filtered[name] = true;
-        }
+        loadFilteredPokemon(ctx, filters);
     }
 
-    // Load file to a vector
-    AutoFile f = fopen(conf.gameMasterFile, "rb");
-    std::vector<uint8_t> message;
-
-    fseek(f, 0, SEEK_END);
-    size_t fileSize = ftell(f);
-    fseek(f, 0, SEEK_SET);
-
-    message.resize(fileSize);
-    fread(&message[0], fileSize, 1, f);
-
     // Parse protobuf and read pokémon data.
-    ProtoBuf pb(&message[0], message.size());
+    PhaseTimer timer(conf.printTimes);
 
-    std::regex pokemonPattern("^V(\\d+)_POKEMON_(.*)$");
-    std::regex movePattern("^V(\\d+)_MOVE_(.*)$");
-    std::regex typePattern("^POKEMON_TYPE_(.*)$");
+    ResultCache cache;
+    bool reportsCached = false; // Reports linked from the -cache.
 
-    while (pb.getBytesLeft())
+    if ((conf.dump == DumpFormat::NONE) && !conf.patchFile && !conf.outputFile && !conf.cacheDir)
     {
-        Message msg = pb.getMessage();
-
-        if ((msg.type == WireType::LENGTH_PREFIXED) && ((PogoProtoTag)msg.tag == PogoProtoTag::ITEM_TEMPLATE))
+        if (!strcmp(conf.gameMasterFile, "-"))
         {
-            ProtoBuf subProto(msg);
-            Message name;
-            Message details;
-
-            while (subProto.getBytesLeft())
-            {
-                Message msg2 = subProto.getMessage();
-
-                switch ((ItemTemplateTag)msg2.tag)
-                {
-                    case ItemTemplateTag::ITEM_NAME: name = msg2; break;
-                    case ItemTemplateTag::POKEMON_DETAILS:
-                    case ItemTemplateTag::MOVE_DETAILS:
-                    case ItemTemplateTag::POKEMON_TYPE_DETAILS:
-                        details = msg2; break;
-                }
-            }
-
-            if ((name.type != WireType::LENGTH_PREFIXED) || (details.type != WireType::LENGTH_PREFIXED)) continue;
-
-            std::string template_str((const char *)name.data.subMessage.buf, name.data.subMessage.n);
-            std::smatch match;
-            if (std::regex_search(template_str, match, pokemonPattern))
-            {
-                // Pokemon found.
-                if (filtered.find(match[2].str()) != filtered.end()) continue;
-
-                int id = strtol(match[1].str().c_str(), NULL, 10);
-                PokemonInfo pi;
-
-                pi.name = match[2].str();
-
-                ProtoBuf pokemonInfoBuf(details);
-
-                while (pokemonInfoBuf.getBytesLeft())
-                {
-                    Message msg3 = pokemonInfoBuf.getMessage();
-
-                    switch ((PokemonDetailsTag)msg3.tag)
-                    {
-                        case PokemonDetailsTag::PRIMARY_TYPE:
-                        case PokemonDetailsTag::SECONDARY_TYPE:
-                            pi.pokemonTypes.push_back(msg3.data.varInt);
-                            break;
-                        case PokemonDetailsTag::BASE_STATS:
-                        {
-                            ProtoBuf baseStatsBuf(msg3);
-
-                            while (baseStatsBuf.getBytesLeft())
-                            {
-                                Message msg4 = baseStatsBuf.getMessage();
-                                if (msg4.type == WireType::VARINT)
-                                {
-                                    switch ((BaseStatsTag)msg4.tag)
-                                    {
-                                        case BaseStatsTag::STAMINA: pi.baseStamina = msg4.data.varInt; break;
-                                        case BaseStatsTag::ATTACK: pi.baseAtk = msg4.data.varInt; break;
-                                        case BaseStatsTag::DEFENSE: pi.baseDef = msg4.data.varInt; break;
-                                    }
-                                }
-                            }
-                            break;
-                        }
-                        case PokemonDetailsTag::QUICK_MOVES:
-                        {
-                            ProtoBuf fastMoves(msg3);
-
-                            // Series of repeated varints.
-                            while (fastMoves.getBytesLeft())
-                            {
-                                pi.fastMoves.push_back(fastMoves.readVarInt());
-                            }
-                            break;
-                        }
-                        case PokemonDetailsTag::CHARGED_MOVES:
-                        {
-                            ProtoBuf chargedMoves(msg3);
-
-                            // Series of repeated varints.
-                            while (chargedMoves.getBytesLeft())
-                            {
-                                pi.chargedMoves.push_back(chargedMoves.readVarInt());
-                            }
-                            break;
-                        }
-                    }
-                }
-
-                pi.nAvailableChargedMoves = pi.chargedMoves.size();
-                pi.nAvailableFastMoves = pi.fastMoves.size();
-
-                pi.id = id;
-                double CPBase = (pi.baseAtk + 15) * sqrt((pi.baseDef + 15) * (pi.baseStamina + 15));
-                pi.maxCP = CPBase * LEVEL40_CP_MULTIPLIER * LEVEL40_CP_MULTIPLIER / 10.0;
-                if (pi.maxCP < conf.prestigerCP)
-                {
-                    pi.prestigerCPMultiplier = 0;
-                }
-                else
-                {
-                    pi.prestigerCPMultiplier = sqrt(conf.prestigerCP * 10 / CPBase);
-                }
-                pi.tankiness = (pi.baseDef + 15) * (pi.baseStamina + 15);
-                pi.trueStrength = (pi.baseAtk + 15) * pi.tankiness / 10000.0;
-
-                pokemonList[id] = pi;
-
-                pokemonNameToId[pi.name] = id;
-            }
-
-            if (std::regex_search(template_str, match, movePattern))
-            {
-                // Move description found!
-                int id = strtol(match[1].str().c_str(), NULL, 10);
-
-                ProtoBuf moveDetails(details);
-                MoveInfo mi;
-
-                mi.name = match[2].str();
-
-                while (moveDetails.getBytesLeft())
-                {
-                    Message msg3 = moveDetails.getMessage();
-
-                    switch ((MoveDetailsTag)msg3.tag)
-                    {
-                        case MoveDetailsTag::TYPE:
-                            mi.moveType = msg3.data.varInt;
-                            break;
-                        case MoveDetailsTag::POWER:
-                            memcpy(&mi.power, msg3.data.fixed, 4);
-                            break;
-                        case MoveDetailsTag::DURATION:
-                            mi.duration = msg3.data.varInt / 1000.0;
-                            break;
-                        case MoveDetailsTag::ENERGY:
-                            mi.energy = (int64_t)msg3.data.varInt;
-                            break;
-
-                    }
-                }
-
-                mi.id = id;
-                mi.eps = mi.energy / mi.duration;
-                mi.dps = mi.power / mi.duration;
-                mi.dpe = mi.power / mi.energy;
-
-                moveList[id] = mi;
-
-                moveNameToId[mi.name] = id;
-            }
-
-            if (std::regex_search(template_str, match, typePattern))
-            {
-                // Type found
-
-                ProtoBuf typeDetails(details);
-                int id = -1;
-                std::map<int, float> typeEffeciveness;
-
-                while (typeDetails.getBytesLeft())
-                {
-                    Message msg3 = typeDetails.getMessage();
-
-                    switch ((TypeDetailsTag)msg3.tag)
-                    {
-                        case TypeDetailsTag::TYPE_CHART: // Type chart
-                            {
-                                int index = 1;
-                                ProtoBuf damageTable(msg3);
-
-                                while (damageTable.getBytesLeft())
-                                {
-                                    float effectiveness;
-                                    uint8_t bytes[4];
-
-                                    damageTable.readBytes(bytes, 4);
-                                    memcpy(&effectiveness, bytes, 4);
-                                    typeEffeciveness[index] = effectiveness;
-
-                                    index++;
-                                }
-                            }
-                            break;
-                        case TypeDetailsTag::ID: // Type id
-                            id = msg3.data.varInt;
-                            break;
-                    }
-                }
-
-                typeNames[id] = match[1].str();
-                typeChart[id] = typeEffeciveness;
-            }
+            if (loadGameMaster(gameData, stdin, conf)) return 1;
         }
-    }
-
-    // Set up legacy movesets.
-    if (conf.legacyMoves)
-    {
-        std::ifstream ifs(conf.legacyMoves);
-
-        for (;;)
+        else
         {
-            std::string pokemon;
-
-            if (!(ifs >> pokemon)) break; // Break out when there is no entry.
+            AutoFile f = fopen(conf.gameMasterFile, "rb");
 
-            std::string legacyMove;
-
-            if (!(ifs >> legacyMove))
-            {
-                fprintf(stderr, "We have the pokemoin name but the legacy move is missing!\n");
-                return 1;
-            }
-
-            addLegacyMove(pokemon.c_str(), legacyMove.c_str());
+            if (loadGameMaster(gameData, f, conf)) return 1;
         }
+        timer.phaseDone("Reading and parsing");
     }
-
-    // Pokemon by CP
+    else
     {
-        std::vector<PokemonInfo> pis; // A temporary vector to sort.
-
-        for (const auto &pi : pokemonList)
-        {
-            pis.push_back(pi.second);
-        }
-
-        std::sort(pis.begin(), pis.end(), [](PokemonInfo a, PokemonInfo b) {return a.maxCP > b.maxCP; } ) ;
-
-        {
-            AutoFile cpFile = fopen("cplist.txt", "w");
-            fprintf(cpFile, "Highest CP\n\n");
-
-            for (const auto &pi : pis)
-            {
-                fprintf(cpFile, "%s: %g\n", pi.name.c_str(), pi.maxCP);
-            }
-        }
-
-        std::sort(pis.begin(), pis.end(), [](PokemonInfo a, PokemonInfo b) {return a.tankiness > b.tankiness; });
+        // The whole game master is needed in memory to patch, write, dump or hash it.
+        GameMasterBytes bytes;
 
+        if (!strcmp(conf.gameMasterFile, "-"))
         {
-            AutoFile tankinessFile = fopen("tankiness.txt", "w");
-            fprintf(tankinessFile, "Highest effective HP (Defense * Stamina)\n\n");
-
-            for (const auto &pi : pis)
-            {
-                fprintf(tankinessFile, "%s:  %g\n", pi.name.c_str(), pi.tankiness);
-            }
+            if (bytes.load(stdin, conf)) return 1;
         }
-
-        std::sort(pis.begin(), pis.end(), [](PokemonInfo a, PokemonInfo b) {return a.trueStrength > b.trueStrength; });
-
+        else
         {
-            AutoFile trueStrengthFile = fopen("truestrength.txt", "w");
-            fprintf(trueStrengthFile, "Best Defense*Attackl*Stamina\n\n");
+            AutoFile f = fopen(conf.gameMasterFile, "rb");
 
-            for (const auto &pi : pis)
-            {
-                fprintf(trueStrengthFile, "%s:  %g\n", pi.name.c_str(), pi.trueStrength);
-            }
+            if (bytes.load(f, conf)) return 1;
         }
-    }
-
-    // Moves list
-
-    AutoFile moves = fopen(MOVE_LIST_FILE, "w");
-
-    fprintf(moves, "%-5s%-30s %-30s %-10s %-10s %-10s %-10s %-10s %-10s\n",
-        "Id",
-        "Name",
-        "Type",
-        "Power",
-        "Energy",
-        "Duration",
-        "EPS",
-        "DPS",
-        "DPE"
-    );
-
-    std::vector<MoveInfo> moveByName; // To store the list of moves alphabetically.
-    for (const auto &mip : moveList)
-    {
-        moveByName.push_back(mip.second);
-    }
-    std::sort(moveByName.begin(), moveByName.end(), [](MoveInfo a, MoveInfo b){return a.name < b.name;});
-
-    for (const auto &mi : moveByName)
-    {
-        fprintf(moves, "%-5d%-30s %-30s %-10g %-10d %-10g %-10g %-10g %-10g\n",
-            mi.id,
-            mi.name.c_str(),
-            typeNames[mi.moveType].c_str(),
-            mi.power,
-            mi.energy,
-            mi.duration,
-            mi.eps,
-            mi.dps,
-            mi.dpe
-        );
-    }
-
-    // Pokemon info and moves
-
-    std::vector<MovesetDPS> overallMovesetStats; // Single bucket to sort all moveset stats
-    AutoFile pokemons = fopen(POKEMON_LIST_FILE, "w");
-
-    std::map<int, std::vector<MovesetDPS>> movesetStatsByType; // Moveset stats for each type
-    std::map<int, std::map<int, std::vector<MovesetDPS>>> bestCounters; // Moveset stats for each type combination (FIXME: the key should be a int, int tuple instead of this)
-
-    // For each pokémon...
-    for (const auto &kv : pokemonList)
-    {
-        const PokemonInfo &pi = kv.second;
+        timer.phaseDone("Reading");
 
-        std::stringstream str;
-        for (auto tid : pi.pokemonTypes)
+        if (conf.patchFile || conf.outputFile)
         {
-            str << typeNames[tid] << " ";
-        }
-
-        fprintf(pokemons, "#%d %s (Type: %s) (Max CP: %g, ATK: %d, DEF: %d, STA: %d), prestiger CP multiplier: %g\n",
-            pi.id,
-            pi.name.c_str(),
-            str.str().c_str(),
-            pi.maxCP,
-            pi.baseAtk,
-            pi.baseDef,
-            pi.baseStamina,
-            pi.prestigerCPMultiplier
-        );
-        fprintf(pokemons, "Fast moves: \n");
-
-        std::vector<MovesetDPS> pokemonMovesets; // Movesets of the pokémon.
+            ProtoEncoder encoded;
 
-        bool highlighted = (conf.highlightPokemonName) && (pi.name == conf.highlightPokemonName);
+            if (!conf.patchFile) encoded.reference(bytes.getData(), bytes.getSize());
+            else if (patchGameMaster(bytes, conf, encoded)) return 1;
+            timer.phaseDone("Patching");
 
-        // For each moveset combination...
-        for (size_t i = 0; i < pi.fastMoves.size(); i++)
-        {
-            int fmi = pi.fastMoves[i];
-            for (size_t j = 0; j < pi.chargedMoves.size(); j++)
+            if (conf.outputFile)
             {
-                int cmi = pi.chargedMoves[j];
-                // Simulate hitting a punching bag for conf.lifeTime seconds.
-                MoveInfo &fastMove = moveList[fmi];
-                MoveInfo &chargedMove = moveList[cmi];
-
-                DamageInfo dmg = calculateDPS(pi, fastMove, chargedMove, ATTACKER_CPM, highlighted);
-                DamageInfo dmgPrestiger = calculateDPS(pi, fastMove, chargedMove, pi.prestigerCPMultiplier, highlighted);
-
-                bool dodging = dmg.expectedHitsPerTurn > 0;
-                bool legacy = (i >= pi.nAvailableFastMoves) || (j >= pi.nAvailableChargedMoves);
-
-                if (!dodging) continue;
-
-                MovesetDPS mDPS;
-
-                // Get the overall DPS.
-                double rawDps = dmg.primaryDPS + dmg.secondaryDPS;
-                double prestigeDps = dmgPrestiger.primaryDPS + dmgPrestiger.secondaryDPS;
-
-                /* printf("Moveset DPS: %g\n", rawDps); */
-
-                mDPS.pokemonId = kv.first;
-                mDPS.fastId = fmi;
-                mDPS.chargedId = cmi;
-                mDPS.populate(rawDps, prestigeDps, pi);
-                mDPS.isLegacy = legacy;
-                mDPS.dodging = dodging;
-                mDPS.fastAttacksPerTurn = dmg.expectedHitsPerTurn;
-                mDPS.nChargedUsed = dmg.chargedsUsed;
-
-                // Store them for the pokémon and the overall bucket.
-                pokemonMovesets.push_back(mDPS);
-                overallMovesetStats.push_back(mDPS);
+                int result = writeGameMaster(encoded, conf.outputFile);
 
-                // TODO: Hidden power of all type.
-                // Put them into the typed buckets to find out
-                if (chargedMove.moveType == fastMove.moveType)
-                {
-                    // Same type of damage
-                    movesetStatsByType[fastMove.moveType].push_back(mDPS);
-                }
-                else
-                {
-                    // Fast and charged are different.
-                    MovesetDPS primaryDPS = mDPS;
-                    primaryDPS.populate(dmg.primaryDPS, dmgPrestiger.primaryDPS, pi);
-                    movesetStatsByType[fastMove.moveType].push_back(primaryDPS);
-
-                    MovesetDPS secondaryDPS = mDPS;
-                    secondaryDPS.populate(dmg.secondaryDPS, dmgPrestiger.secondaryDPS, pi);
-                    movesetStatsByType[chargedMove.moveType].push_back(secondaryDPS);
-                }
-
-                // For each type combination...
-                for (const auto &tnp1 : typeChart)
-                {
-                    for (const auto &tnp2: typeChart)
-                    {
-                        if (tnp1.first > tnp2.first) continue; // To avoid duplicates.
-
-                        // Find out how much damage each moveset does against each combination of moves.
-                        double theDPS;
-                        double thePrestigerDPS;
-
-                        if (tnp1.first == tnp2.first)
-                        {
-                            // Single typed pokémon are stored as double typed of the same type. Mind this.
-                            theDPS = dmg.primaryDPS * typeChart[fastMove.moveType][tnp1.first]
-                            + dmg.secondaryDPS * typeChart[chargedMove.moveType][tnp1.first];
-                            thePrestigerDPS = dmgPrestiger.primaryDPS * typeChart[fastMove.moveType][tnp1.first]
-                            + dmgPrestiger.secondaryDPS * typeChart[chargedMove.moveType][tnp1.first];
-                        }
-                        else
-                        {
-                            theDPS =
-                                dmg.primaryDPS * typeChart[fastMove.moveType][tnp1.first] * typeChart[fastMove.moveType][tnp2.first]
-                                + dmg.secondaryDPS * typeChart[chargedMove.moveType][tnp1.first] * typeChart[chargedMove.moveType][tnp2.first];
-                            thePrestigerDPS =
-                                dmgPrestiger.primaryDPS * typeChart[fastMove.moveType][tnp1.first] * typeChart[fastMove.moveType][tnp2.first]
-                                + dmgPrestiger.secondaryDPS * typeChart[chargedMove.moveType][tnp1.first] * typeChart[chargedMove.moveType][tnp2.first];
-                        }
-                        MovesetDPS dps = mDPS;
-                        dps.populate(theDPS, thePrestigerDPS, pi);
-                        bestCounters[tnp1.first][tnp2.first].push_back(dps);
-                    }
-                }
+                timer.phaseDone("Writing");
+                return result;
             }
+            bytes.replace(encoded.flatten());
         }
 
-        // Write out each pokémon and their respective moveset.
-        std::sort(pokemonMovesets.begin(), pokemonMovesets.end(), [](MovesetDPS a, MovesetDPS b){return a.DPS > b.DPS; });
-        for (const auto &mdps : pokemonMovesets)
+        if (conf.dump != DumpFormat::NONE)
         {
-            mdps.printEntry(pokemons, mdps.DPS);
-        }
-        fprintf(pokemons, "\n");
-    }
-
-    // Write the overall DPS list.
-    AutoFile dpsList = fopen("DPS.txt", "w");
-    fprintf(dpsList, "Highest damage per second (moveset DPS * Attack)\n\n");
-    std::sort(overallMovesetStats.begin(), overallMovesetStats.end(), [](MovesetDPS a, MovesetDPS b){return a.DPS > b.DPS; });
-    for (const auto &mdps : overallMovesetStats)
-    {
-        mdps.printEntry(dpsList, mdps.DPS);
-    }
-
-    // Write the true power list.
-    AutoFile dtfList = fopen("DTF.txt", "w");
-    fprintf(dtfList, "Highest damage till fainting (moveset DPS * Attack * Defense * Stamina)\n\n");
-    std::sort(overallMovesetStats.begin(), overallMovesetStats.end(), [](MovesetDPS a, MovesetDPS b){return a.truePower > b.truePower; });
-    for (const auto &mdps : overallMovesetStats)
-    {
-        mdps.printEntry(dtfList, mdps.truePower);
-    }
-
-    // Best DPS by Type
-    AutoFile bestAttackersByType = fopen("DPSbyType.txt", "w");
-    fprintf(bestAttackersByType, "Highest damage per second per type\n\n");
-    for (auto &typeVecPair : movesetStatsByType)
-    {
-        auto &typeVec = typeVecPair.second;
+            int result = dumpGameData(bytes.getData(), bytes.getSize(), conf);
 
-        std::sort(typeVec.begin(), typeVec.end(), [](MovesetDPS a, MovesetDPS b){return a.DPS > b.DPS; });
-    }
-
-    for (const auto &typeVecPair : movesetStatsByType)
-    {
-        fprintf(bestAttackersByType, "Best attackers of %s type:\n\n", typeNames[typeVecPair.first].c_str());
-        for (const auto &mdps : typeVecPair.second)
-        {
-            mdps.printEntry(bestAttackersByType, mdps.DPS);
+            timer.phaseDone("Dump");
+            return result;
         }
-        fprintf(bestAttackersByType, "\n\n");
-    }
-
-    // Write best true power by type.
-    AutoFile bestDTFByType = fopen("DTFbyType.txt", "w");
-    fprintf(bestDTFByType, "Highest damage tilll fainting per type\n\n");
-    for (auto &typeVecPair : movesetStatsByType)
-    {
-        auto &typeVec = typeVecPair.second;
 
-        std::sort(typeVec.begin(), typeVec.end(), [](MovesetDPS a, MovesetDPS b){return a.truePower > b.truePower; });
-    }
-
-    for (const auto &typeVecPair : movesetStatsByType)
-    {
-        fprintf(bestDTFByType, "Best attackers of %s type:\n\n", typeNames[typeVecPair.first].c_str());
-        for (const auto &mdps : typeVecPair.second)
+        cache.open(conf, bytes.getData(), bytes.getSize());
+        reportsCached = cache.linkReports(conf);
+        timer.phaseDone("Cache lookup");
+        if (reportsCached && !conf.query)
         {
-            mdps.printEntry(bestDTFByType, mdps.truePower);
+            printf("TXT files with various stats has been restored from %s.\n", conf.cacheDir);
+            return 0;
         }
-        fprintf(bestDTFByType, "\n\n");
-    }
-
-    // Write best counters by DPS
-    AutoFile bestDPSCountersFile = fopen("DPSCounters.txt", "w");
-    fprintf(bestDPSCountersFile, "Best DPS against particular types.\n\n");
-    for (auto &t1 : bestCounters)
-    {
-        for (auto &t2 : t1.second)
-        {
-            auto &vec = t2.second;
 
-            std::sort(vec.begin(), vec.end(), [](MovesetDPS a, MovesetDPS b){return a.DPS > b.DPS; });
-        }
-    }
+        DecodeError error;
 
-    for (const auto &t1 : bestCounters)
-    {
-        for (const auto &t2 : t1.second)
+        if (decodeGameData(gameData, bytes.getData(), bytes.getSize(), error) != DecodeStatus::OK)
         {
-            const auto &vec = t2.second;
-
-            fprintf(bestDPSCountersFile, "Best counters of %s-%s\n\n", typeNames[t1.first].c_str(), typeNames[t2.first].c_str());
-            for (const auto &mdps : vec)
-            {
-                mdps.printEntry(bestDPSCountersFile, mdps.DPS);
-            }
-            fprintf(bestDPSCountersFile, "\n\n");
+            fprintf(stderr, "Malformed game master at offset %zu.\n", (size_t)(error.at - bytes.getData()));
+            return 1;
         }
+        timer.phaseDone("Parsing");
     }
 
-    // Write Best counters by True power
-    AutoFile bestDTFCountersFile = fopen("DTFCounters.txt", "w");
-    fprintf(bestDTFCountersFile, "Best DTF against particular types.\n\n");
-    for (auto &t1 : bestCounters)
-    {
-        for (auto &t2 : t1.second)
-        {
-            auto &vec = t2.second;
+    if (setupAnalysis(ctx)) return 1;
 
-            std::sort(vec.begin(), vec.end(), [](MovesetDPS a, MovesetDPS b){return a.truePower > b.truePower; });
-        }
-    }
+    CounterQuery query;
 
-    for (const auto &t1 : bestCounters)
+    if (conf.query && parseQuery(gameData, conf.query, query))
     {
-        for (const auto &t2 : t1.second)
-        {
-            const auto &vec = t2.second;
-
-            fprintf(bestDTFCountersFile, "Best counters of %s-%s\n\n", typeNames[t1.first].c_str(), typeNames[t2.first].c_str());
-            for (const auto &mdps : vec)
-            {
-                mdps.printEntry(bestDTFCountersFile, mdps.truePower);
-            }
-            fprintf(bestDTFCountersFile, "\n\n");
-        }
+        fprintf(stderr, "Invalid query: %s\n", conf.query);
+        return 1;
     }
 
-    // Best prestigers
-    AutoFile prestigersFile = fopen("prestigers.txt", "w");
-    fprintf(prestigersFile, "Best prestigers against particular types.\n\n");
-    for (auto &t1 : bestCounters)
-    {
-        for (auto &t2 : t1.second)
-        {
-            auto &vec = t2.second;
-
-            std::sort(vec.begin(), vec.end(), [](MovesetDPS a, MovesetDPS b){return a.prestigePower > b.prestigePower; });
-        }
-    }
+    AnalysisResults results;
+    bool cached = cache.loadResults(ctx, results);
 
-    for (const auto &t1 : bestCounters)
+    if (!cached) reportsCached = false;
+    runAnalysis(ctx, results, conf.query ? &query : NULL, cached, reportsCached);
+    if (!cached && cache.isUsed())
     {
-        for (const auto &t2 : t1.second)
-        {
-            const auto &vec = t2.second;
+        PhaseTimer storeTimer(conf.printTimes);
 
-            fprintf(prestigersFile, "Best counters of %s-%s\n\n", typeNames[t1.first].c_str(), typeNames[t2.first].c_str());
-            for (const auto &mdps : vec)
-            {
-                mdps.printEntry(prestigersFile, mdps.prestigePower);
-            }
-            fprintf(bestDTFCountersFile, "\n\n");
-        }
+        cache.store(conf, results);
+        storeTimer.phaseDone("Cache store");
     }
 
-    printf("TXT files with various stats has been written.\n");
+    if (reportsCached) printf("TXT files with various stats has been restored from %s.\n", conf.cacheDir);
+    else printf("TXT files with various stats has been written.\n");
 
     return 0;
 }
+
+#endif
@@ -0,0 +1,154 @@
+/* C interface of the pogoproto analyzer.
+
+    Build the shared library with:
+
+    g++ -std=c++11 -O2 -shared -fPIC -fvisibility=hidden -pthread -DPOGOPROTO_LIBRARY pogoproto.cpp -o libpogoproto.so
+
+    Functions returning int return a PogoStatus. No C++ exception leaves the library.
+    Loaded game data is read only, so it can be shared by analyses running in different threads.
+    An analysis handle can be queried from several threads at once.
+ */
+
+#ifndef POGOPROTO_H
+#define POGOPROTO_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(_WIN32)
+#define POGO_API __declspec(dllexport)
+#else
+#define POGO_API __attribute__((visibility("default")))
+#endif
+
+typedef struct PogoGameData PogoGameData; /* Parsed game master. */
+typedef struct PogoAnalysis PogoAnalysis; /* Simulated movesets for a configuration. */
+typedef struct PogoGameIndex PogoGameIndex; /* Game master decoded on demand. */
+
+enum PogoStatus
+{
+    POGO_OK = 0,
+    POGO_INVALID_ARGUMENT = 1,
+    POGO_PARSE_ERROR = 2, /* The game master is malformed. */
+    POGO_NOT_FOUND = 3, /* No such pokémon, move, type or moveset. */
+    POGO_BUFFER_TOO_SMALL = 4, /* The output did not fit, the required size is reported. */
+    POGO_INTERNAL_ERROR = 5
+};
+
+enum PogoSortKey
+{
+    POGO_SORT_DPS = 0, /* Moveset DPS * attack */
+    POGO_SORT_TRUE_POWER = 1, /* Damage till fainting */
+    POGO_SORT_PRESTIGE_POWER = 2
+};
+
+/* Simulation parameters, see the command line options with the same name. */
+typedef struct PogoConfig
+{
+    double roundLength; /* -rl */
+    double lifeTime; /* -lt */
+    double battleTime; /* -bt */
+    double prestigerCP; /* -pcp */
+    const char *filteredPokemon; /* Contents of a -filt file or NULL. */
+    const char *legacyMoves; /* Contents of a -lm file or NULL. */
+} PogoConfig;
+
+/* A pokémon + moveset tuple. The values are against the queried defender types. */
+typedef struct PogoMoveset
+{
+    int pokemonId;
+    int fastId;
+    int chargedId;
+    int isLegacy;
+    int dodging;
+    int fastAttacksPerTurn;
+    int nChargedUsed;
+    double DPS;
+    double msDPS;
+    double truePower;
+    double prestigePower;
+} PogoMoveset;
+
+/* Conditions on the counters of pogo_top_counters_filtered(), all of them must hold. */
+typedef struct PogoFilter
+{
+    int legacy; /* 1 for legacy movesets only, 0 for non legacy only, -1 for both. */
+    int dodging; /* Same for dodging. */
+    const int *moveTypes; /* The fast or the charged move has one of these types. */
+    size_t nMoveTypes; /* 0 for any type. */
+    const int *pokemonTypes; /* The pokémon has one of these types. */
+    size_t nPokemonTypes; /* 0 for any type. */
+    double minMaxCP; /* Only pokémon with at least this max CP. */
+    const int *excludedPokemon; /* Pokémon ids to leave out. */
+    size_t nExcludedPokemon;
+} PogoFilter;
+
+/* Fills the configuration with the defaults of the command line tool. */
+POGO_API void pogo_default_config(PogoConfig *conf);
+
+/* Returns a static description of the status code. */
+POGO_API const char *pogo_status_string(int status);
+
+/* Parses a game master from memory. The buffer is not referenced after the call returns. */
+POGO_API int pogo_load_game_master(const void *data, size_t size, PogoGameData **gameData);
+
+/* Same as pogo_load_game_master(). On POGO_PARSE_ERROR *errorOffset receives the offset of the malformed data. */
+POGO_API int pogo_load_game_master_at(const void *data, size_t size, PogoGameData **gameData, size_t *errorOffset);
+POGO_API void pogo_free_game_data(PogoGameData *gameData);
+
+/* Id lookups by the names used in the game master (eg. "DRAGONITE", "DRAGON_BREATH_FAST", "DRAGON"). */
+POGO_API int pogo_find_pokemon(const PogoGameData *gameData, const char *name, int *id);
+POGO_API int pogo_find_move(const PogoGameData *gameData, const char *name, int *id);
+POGO_API int pogo_find_type(const PogoGameData *gameData, const char *name, int *id);
+
+/* Copies the zero terminated name into the buffer. On POGO_BUFFER_TOO_SMALL *required holds the needed size. */
+POGO_API int pogo_pokemon_name(const PogoGameData *gameData, int id, char *buf, size_t bufSize, size_t *required);
+POGO_API int pogo_move_name(const PogoGameData *gameData, int id, char *buf, size_t bufSize, size_t *required);
+
+/* Simulates every moveset with the given configuration. The game data must outlive the analysis. */
+POGO_API int pogo_create_analysis(const PogoGameData *gameData, const PogoConfig *conf, PogoAnalysis **analysis);
+POGO_API void pogo_free_analysis(PogoAnalysis *analysis);
+
+/* Simulates one moveset of a pokémon against a defender with the given types.
+    Pass the same type twice for single typed defenders, 0 for both for neutral damage.
+ */
+POGO_API int pogo_query_moveset(const PogoAnalysis *analysis, int pokemonId, int fastId, int chargedId, int type1, int type2, PogoMoveset *result);
+
+/* Writes the best k counters of the type pair into the caller's array, best first.
+    *count receives the number of entries written.
+ */
+POGO_API int pogo_top_counters(const PogoAnalysis *analysis, int type1, int type2, int sortKey, PogoMoveset *results, size_t k, size_t *count);
+
+/* Fills the filter with conditions every moveset passes. */
+POGO_API void pogo_default_filter(PogoFilter *filter);
+
+/* Same as pogo_top_counters() among the movesets passing the filter. */
+POGO_API int pogo_top_counters_filtered(const PogoAnalysis *analysis, int type1, int type2, int sortKey, const PogoFilter *filter, PogoMoveset *results, size_t k, size_t *count);
+
+/* Indexes a game master without decoding the templates, for queries about a few pokémon.
+    Pokémon and moves are decoded on first use and cached, the types when a defender type is first queried.
+    The buffer must stay valid until the index is freed. The cache is filled by the queries, so an index must not be used from several threads at once.
+    On POGO_PARSE_ERROR *errorOffset receives the offset of the malformed data, errors inside the templates are only reported when they are decoded.
+ */
+POGO_API int pogo_index_game_master(const void *data, size_t size, PogoGameIndex **index, size_t *errorOffset);
+POGO_API void pogo_free_game_index(PogoGameIndex *index);
+
+/* Id lookups by name as with PogoGameData. Finding a type decodes the types. */
+POGO_API int pogo_index_find_pokemon(const PogoGameIndex *index, const char *name, int *id);
+POGO_API int pogo_index_find_move(const PogoGameIndex *index, const char *name, int *id);
+POGO_API int pogo_index_find_type(PogoGameIndex *index, const char *name, int *id);
+
+/* Same as pogo_query_moveset() without an analysis, only the pokémon and the two moves are decoded.
+    A move missing from the move lists of the pokémon is a legacy move if conf->legacyMoves lists it, else POGO_NOT_FOUND is returned.
+    conf->filteredPokemon is ignored.
+ */
+POGO_API int pogo_index_query_moveset(PogoGameIndex *index, const PogoConfig *conf, int pokemonId, int fastId, int chargedId, int type1, int type2, PogoMoveset *result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif